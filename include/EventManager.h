@@ -13,11 +13,15 @@
 #include <map>
 #include <functional>
 #include <vector>
+#include <deque>
 #include <string>
+#include <mutex>
 
 #include "utility/Singleton.h"
 #include "utility/JSONMapping.h"
 
+#include "StateController.h"
+
 /**
  * std::function pointer to function for command expects double parameter list and bool (testOnly)
  * std::vector<std::string> list of parameter names in its order
@@ -26,6 +30,57 @@ typedef std::tuple<std::function<void(std::vector<double> &, bool)>, std::vector
 
 //change event mapping when sequence is running to still be able to throw events when sequence is running (or just disable)
 
+enum class TriggerComparator : uint8_t
+{
+    ALWAYS = 0,
+    EQUAL,
+    NOT_EQUAL,
+    GREATER_EQUAL,
+    LESS_EQUAL,
+    GREATER,
+    LESS
+};
+
+enum class EventArgumentSource : uint8_t
+{
+    CONSTANT = 0,
+    //new value of the state that triggered the event
+    TRIGGER_VALUE,
+    //current value of another state
+    STATE
+};
+
+typedef struct
+{
+    EventArgumentSource source;
+    double value;
+    //resolved on first use, registering the state is left to the first read like before
+    std::string stateName;
+    state_id_t stateID;
+} EventArgument_t;
+
+/**
+ * one event of the event mapping, parsed once so evaluating it needs no json access or allocation
+ * either sets targetState to value or calls the command with the arguments
+ */
+typedef struct
+{
+    TriggerComparator comparator;
+    double threshold;
+
+    bool isCommand;
+    std::string targetState;
+    state_id_t targetStateID;
+    EventArgument_t value;
+
+    std::string commandName;
+    //points into commandMap once the command is registered
+    command_t *command;
+    std::vector<EventArgument_t> arguments;
+    //filled in place on every call
+    std::vector<double> argumentValues;
+} EventTrigger_t;
+
 class EventManager : public Singleton<EventManager>
 {
     friend class Singleton;
@@ -45,8 +100,37 @@ private:
     JSONMapping *mapping;
     nlohmann::json mappingJSON;
 
+    //guards the trigger tables, commandMap and channelTypeMap against registrations while events are evaluated
+    std::recursive_mutex triggerMtx;
+    //state name -> compiled events of the EventMapping
+    std::map<std::string, std::vector<EventTrigger_t>> triggerMap;
+    //default events compiled for a single gui state, discarded when channel types change
+    std::deque<std::vector<EventTrigger_t>> defaultTriggers;
+    //state id -> events of the state, nullptr if it has none, filled on the first change of a state
+    std::vector<std::vector<EventTrigger_t> *> stateTriggers;
+    std::vector<bool> stateTriggersResolved;
+
     bool CheckEvents();
 
+    /**
+     * parses events of the mapping, invalid events are reported and skipped
+     * @param stateName state the events belong to, a value equal to it is the new value of the state
+     * @param commandKey parameters equal to it are the new value of the state
+     * @param commandChannelName replaces commandKey in command names if not empty
+     */
+    void CompileEvents(const std::string &stateName, const nlohmann::json &events, const std::string &commandKey,
+                       const std::string &commandChannelName, std::vector<EventTrigger_t> &triggers);
+    EventArgument_t CompileArgument(const nlohmann::json &param, const std::string &key);
+    /**
+     * compiles the DefaultEventMapping entry of the channel type of a gui state, commands are renamed to the channel
+     * @return false if the state has no channel type or its type no default events
+     */
+    bool CompileDefaultEvents(const std::string &stateName, std::vector<EventTrigger_t> &triggers);
+    std::vector<EventTrigger_t> *GetTriggers(state_id_t stateID);
+    static bool ShallTrigger(const EventTrigger_t &trigger, double oldValue, double newValue);
+    static double GetArgument(EventArgument_t &argument, double newValue);
+    void ExecuteTriggers(std::vector<EventTrigger_t> &triggers, double oldValue, double newValue, bool testOnly);
+
     bool ShallTrigger(nlohmann::json& event, double& oldValue, double& newValue);
     double GetArgument(const std::string &stateName, nlohmann::json& param, double& newValue);
     void GetArgumentList(const std::string &stateName, nlohmann::json& event, std::vector<double>& argumentList, double& newValue);
@@ -67,6 +151,7 @@ public:
     virtual std::map<std::string, command_t> GetCommands();
 
     virtual void OnStateChange(const std::string& stateName, double oldValue, double newValue);
+    virtual void OnStateChange(state_id_t stateID, double oldValue, double newValue);
 
     virtual void ExecuteRegexCommandOrState(const std::string &regexKey, nlohmann::json &events, const std::string &stateName, double oldValue, double newValue, bool testOnly);
     virtual void ExecuteCommandOrState(const std::string &stateName, double oldValue, double newValue, bool useDefaultMapping, bool testOnly);
@@ -6,53 +6,233 @@
 #define LLSERVER_ECUI_HOUBOLT_STATECONTROLLER_H
 
 #include <map>
+#include <deque>
 #include <tuple>
 #include <vector>
+#include <array>
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <string>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
 
 #include "common.h"
 
 #include "utility/Singleton.h"
 #include "utility/Config.h"
+#include "utility/BoundedQueue.h"
 
 #include "logging/InfluxDbLogger.h"
 
+/**
+ * dense handle of a state, assigned once on registration and valid for the lifetime of the StateController
+ */
+typedef uint32_t state_id_t;
+
+constexpr state_id_t INVALID_STATE_ID = UINT32_MAX;
+
+typedef struct
+{
+    double value;
+    uint64_t timestamp;
+    bool dirty;
+} StateEntry_t;
+
+typedef struct
+{
+    state_id_t stateID;
+    double value;
+    uint64_t timestamp;
+} DirtyState_t;
+
+/**
+ * states are striped over SHARD_COUNT shards by id, each with its own lock, so writers of different states
+ * rarely meet and a reader of one state only blocks the writers of its shard
+ * bulk reads hold all shard locks only while copying the raw entries, names are added afterwards
+ * state changes are only queued by SetState, logging and the change callback run on the event thread
+ */
 class StateController : public Singleton<StateController>
 {
     friend class Singleton;
 private:
-    std::map<std::string, std::tuple<double, uint64_t, bool>> states;
-    std::function<void(std::string, double, double)> onStateChangeCallback;
+    static constexpr state_id_t SHARD_COUNT = 16;
+
+    typedef struct
+    {
+        //points into stateNames
+        const std::string *stateName;
+        state_id_t stateID;
+        double oldValue;
+        double newValue;
+        uint64_t timestamp;
+    } StateChange_t;
+
+    typedef struct alignas(64)
+    {
+        std::mutex mtx;
+        //state id / SHARD_COUNT -> value, timestamp, dirty flag
+        std::vector<StateEntry_t> entries;
+        //state id / SHARD_COUNT -> name, points into stateNames
+        std::vector<const std::string *> names;
+        //ids of the entries that became dirty since the last collection, appended by the setter that sets the flag
+        std::vector<state_id_t> dirtyIDs;
+        //changes that didn't fit into the event queue and every later change of the shard, the event thread moves
+        //them into the queue in this order, so changes of a state are never reordered
+        std::deque<StateChange_t> pendingChanges;
+        //changes ever appended to pendingChanges, a setter waits until its change was moved into the queue
+        uint64_t pendingAppended = 0;
+        std::atomic_uint64_t pendingMoved = 0;
+
+        std::atomic_uint64_t acquisitions = 0;
+        //acquisitions that had to wait and the total time waited in nanoseconds
+        std::atomic_uint64_t contentions = 0;
+        std::atomic_uint64_t waitTime = 0;
+    } Shard_t;
+
+    static constexpr uint64_t DEFAULT_EVENT_QUEUE_SIZE = 4096;
+
+    //guards the name registry, registration is exclusive, lookups are shared
+    std::shared_mutex registryMtx;
+    //name -> handle, only used on registration and by name based accessors
+    std::unordered_map<std::string, state_id_t> stateIDMap;
+    //handle -> name, deque so references stay valid while new states get registered
+    std::deque<std::string> stateNames;
+    //published after the entry exists in its shard, ids below are valid without the registry lock
+    std::atomic<state_id_t> stateCount = 0;
+
+    std::array<Shard_t, SHARD_COUNT> shards;
+
+    //states with a timestamp of 0, changed under the shard lock of the state
+    std::atomic_int64_t uninitializedCount = 0;
+    //only used to wait for uninitializedCount to reach 0
+    std::mutex initMtx;
+    std::condition_variable initCV;
+
+    //bulk reads holding all shard locks
+    std::atomic_uint64_t snapshots = 0;
+    std::atomic_uint64_t snapshotHoldTime = 0;
+    std::atomic_uint64_t snapshotMaxHoldTime = 0;
+
+    std::function<void(state_id_t, double, double)> onStateChangeCallback;
+
+    std::unique_ptr<BoundedQueue<StateChange_t>> changeQueue;
+    std::thread *eventThread = nullptr;
+    std::atomic<std::thread::id> eventThreadID;
+    std::atomic_bool eventsRunning = false;
+    //incremented after every queued change, the event thread waits on it while the queue is empty
+    std::atomic_uint32_t changeSignal = 0;
+    std::atomic_bool eventThreadWaiting = false;
+    //changes in the pendingChanges of all shards
+    std::atomic_uint64_t pendingChangeCount = 0;
+
+    std::atomic_uint64_t dispatchedChanges = 0;
+    //SetState calls that couldn't queue their change directly because the queue was full or changes were pending
+    std::atomic_uint64_t queueFullCount = 0;
 
 	bool initialized = false;
 
-	std::mutex stateMtx;
-
     InfluxDbLogger *logger = nullptr;
 
+    inline Shard_t &GetShard(state_id_t stateID)
+    { return shards[stateID % SHARD_COUNT]; };
+
+    static inline StateEntry_t &GetEntry(Shard_t &shard, state_id_t stateID)
+    { return shard.entries[stateID / SHARD_COUNT]; };
+
+    /**
+     * locks the shard and counts the acquisition, the waiting time is only measured if the lock is contended
+     */
+    static std::unique_lock<std::mutex> LockShard(Shard_t &shard);
+
+    std::array<std::unique_lock<std::mutex>, SHARD_COUNT> LockAllShards();
+    void CountBulkRead(uint64_t holdTime);
+
+    /**
+     * copies the entries of all states while holding every shard lock
+     */
+    void Snapshot(std::vector<StateEntry_t> &entries);
+
+    //registryMtx must be held exclusively
+    state_id_t RegisterStateUnlocked(const std::string &stateName, bool &isNew, double initialValue = 0.0);
+    state_id_t RegisterState(const std::string &stateName, bool &isNew, double initialValue = 0.0);
+    void CheckStateID(state_id_t stateID, const char *caller);
+    /**
+     * NOTE: the shard lock of the state must be held
+     */
+    void UpdateInitialized(uint64_t oldTimestamp, uint64_t newTimestamp);
+
+    void QueueChange(Shard_t &shard, const StateChange_t &change, std::unique_lock<std::mutex> &shardLock);
+    void SignalChange();
+    /**
+     * moves the pending changes of every shard into the queue as long as there is room, only called by the event thread
+     */
+    void MovePendingChanges();
+    void DispatchChange(const StateChange_t &change);
+    void eventLoop();
+
     ~StateController();
 public:
 
-    std::size_t count = 0;
+    std::atomic_size_t count = 0;
     //TODO: MP Maybe add timestamp to callback argument as well
-    void Init(std::function<void(std::string, double, double)> onStateChangeCallback, Config &config);
+    void Init(std::function<void(state_id_t, double, double)> onStateChangeCallback, Config &config);
+    /**
+     * dispatches the changes still queued and stops the event thread, changes set afterwards are neither
+     * logged nor passed to the callback
+     */
+    void StopEvents();
 
     /**
-     * blocks until all map entries have a timestamp != 0
-     * all states should already be added at this point, no checking if sates are added afterwards
+     * blocks until all states have a timestamp != 0 or the timeout expires, prints the number of missing
+     * states every progressInterval and their names on timeout
+     * states added while waiting have to be initialized as well
+     * @return true if all states are initialized
      */
-    void WaitUntilStatesInitialized();
+    bool WaitUntilStatesInitialized(std::chrono::milliseconds timeout,
+                                    std::chrono::milliseconds progressInterval = std::chrono::milliseconds(1000));
+    /**
+     * @return names of the states that have never been set with a timestamp
+     */
+    std::vector<std::string> GetUninitializedStates();
 
-    void AddUninitializedStates(std::vector<std::string> &states);
+    /**
+     * returns the handle of the state, registers it uninitialized if it doesn't exist yet
+     */
+    state_id_t RegisterState(const std::string &stateName);
+    /**
+     * @return handle of the state or INVALID_STATE_ID if not registered
+     */
+    state_id_t GetStateID(const std::string &stateName);
+    const std::string &GetStateName(state_id_t stateID);
+
+    std::vector<state_id_t> AddUninitializedStates(std::vector<std::string> &states);
     void AddStates(std::map<std::string, std::tuple<double, uint64_t>> &states);
+
     std::tuple<double, uint64_t, bool> GetState(std::string stateName);
+    std::tuple<double, uint64_t, bool> GetState(state_id_t stateID);
     void SetState(std::string stateName, double value, uint64_t timestamp);
+    void SetState(state_id_t stateID, double value, uint64_t timestamp);
 
     double GetStateValue(std::string stateName);
+    double GetStateValue(state_id_t stateID);
+    /**
+     * fills dirtyStates with the states changed since the last call and clears their dirty flags
+     * only the changed states are visited, the buffer is meant to be reused so it keeps its capacity
+     */
+    void GetDirtyStates(std::vector<DirtyState_t> &dirtyStates);
     std::map<std::string, std::tuple<double, uint64_t>> GetDirtyStates();
 	std::map<std::string, std::tuple<double, uint64_t, bool>> GetAllStates();
 
+    /**
+     * prints acquisitions, contentions and waiting time of every shard lock, the hold time of bulk reads
+     * and the state of the event queue
+     */
+    void PrintLockStats(std::vector<double> &params, bool testOnly);
 };
 
 #endif //LLSERVER_ECUI_HOUBOLT_STATECONTROLLER_H
@@ -4,6 +4,7 @@
 #include <map>
 #include <functional>
 #include <string>
+#include <span>
 #include "common.h"
 
 
@@ -37,16 +38,47 @@ const std::map<uint32_t, uint32_t> dlcToCANFDMsgLength = {
 };
 
 
+/**
+ * received frame, the payload is only valid during the receive callback
+ */
+typedef struct
+{
+	uint8_t canBusChannelID;
+	uint32_t canID;
+	uint8_t *payload;
+	uint32_t payloadLength;
+	uint64_t timestamp;
+} CANFrame_t;
+
+
 class CANDriver
 {
 	protected:
 		std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback;
+		std::function<void(std::span<CANFrame_t>, CANDriver *driver)> onRecvBatchCallback;
 		std::function<void(std::string *)> onErrorCallback;
         std::vector<uint32_t> canBusChannelIDs;
 
+		/**
+		 * hands frames received together to the batch callback, or one by one to the receive callback if there is none
+		 */
+		inline void deliverBatch(std::span<CANFrame_t> frames)
+		{
+			if (onRecvBatchCallback)
+			{
+				onRecvBatchCallback(frames, this);
+				return;
+			}
+			for (CANFrame_t &frame : frames)
+			{
+				onRecvCallback(frame.canBusChannelID, frame.canID, frame.payload, frame.payloadLength, frame.timestamp, this);
+			}
+		}
+
     public:
         CANDriver(std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback,
-                  std::function<void(std::string *)> onErrorCallback);
+                  std::function<void(std::string *)> onErrorCallback,
+                  std::function<void(std::span<CANFrame_t>, CANDriver *driver)> onRecvBatchCallback = nullptr);
         virtual ~CANDriver();
 
         virtual void SendCANMessage(uint32_t canBusChannelID, uint32_t canID, uint8_t *payload, uint32_t payloadLength, bool blocking);
@@ -3,19 +3,39 @@
 #ifndef NO_CANLIB
 
 #include "CANDriver.h"
+#include "CANTransmitQueue.h"
+#include "CANReceiveQueue.h"
 
 
 #include <vector>
 #include <map>
 #include <functional>
 #include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
 #include <canlib.h>
 #include "common.h"
 #include "utility/Config.h"
 
+/**
+ * the canlib notify callback only drains canRead into a CANReceiveQueue per bus, a worker thread per bus decodes
+ * the frames, so a slow state update or event never lets the canlib buffers overrun
+ */
 class CANDriverKvaser : public CANDriver
 {
     private:
+        typedef struct
+        {
+            CANDriverKvaser *driver;
+            uint32_t canBusChannelID;
+            canHandle handle;
+            std::unique_ptr<CANReceiveQueue> queue;
+            //frames read while the queue was full
+            std::atomic_uint64_t droppedFrames;
+            std::thread worker;
+        } Receiver_t;
+
         std::map<uint32_t, canHandle> canHandlesMap = std::map<uint32_t, canHandle>();
 
 		std::map<uint32_t, CANParams> arbitrationParamsMap = std::map<uint32_t, CANParams>();
@@ -23,13 +43,25 @@ class CANDriverKvaser : public CANDriver
 
         uint64_t blockingTimeout;
 
+        size_t receiveQueueSize = 4096;
+        size_t receiveBatchSize = 64;
+        std::vector<int> receiveThreadCores;
+        //one per bus, passed to the notify callback as its context
+        std::vector<std::unique_ptr<Receiver_t>> receivers;
+        std::atomic_bool done = false;
+        void receiveLoop(Receiver_t *receiver, int core);
+
+        CANTransmitQueue *transmitQueue = nullptr;
+        void SendBatch(uint32_t canBusChannelID, std::span<TxFrame_t> frames);
+
         static void OnCANCallback(int handle, void *driver, unsigned int event);
         std::string CANError(canStatus status);
-        canStatus InitializeCANChannel(uint32_t canChannelID);
+        canStatus InitializeCANChannel(uint32_t canChannelID, Receiver_t *receiver);
 
     public:
         CANDriverKvaser(std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback,
-						std::function<void(std::string *)> onErrorCallback, std::vector<uint32_t> &canBusChannelIDs, Config &config);
+						std::function<void(std::string *)> onErrorCallback, std::vector<uint32_t> &canBusChannelIDs, Config &config,
+						std::function<void(std::span<CANFrame_t>, CANDriver *driver)> onRecvBatchCallback = nullptr);
         ~CANDriverKvaser();
 
         void SendCANMessage(uint32_t canBusChannelID, uint32_t canID, uint8_t *payload, uint32_t payloadLength, bool blocking);
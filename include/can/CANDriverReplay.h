@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <functional>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "common.h"
+#include "utility/Config.h"
+#include "CANDriver.h"
+#include "CANRecorder.h"
+
+/**
+ * plays a recording of the CANRecorder back into the receive callback, no can hardware needed
+ *
+ * node discovery: every node info request is answered with the node info responses of the recording,
+ * the remaining frames are played after Start, which the CANManager calls once it is initialized,
+ * frames received before would be discarded
+ * frames keep their original timestamps, transmitted messages are discarded
+ *
+ * config (CAN section):
+ *  replay_path         directory of the recording
+ *  replay_speed        optional, 1.0 plays in real time, N plays N times faster, 0 plays as fast as possible
+ *  replay_start_time   optional, unix timestamp in microseconds to start at, seeks with the recording index
+ */
+class CANDriverReplay : public CANDriver
+{
+    private:
+        void replayLoop();
+        void replayNodeInfos();
+        static bool isNodeInfo(const CANRecord::Frame_t &frame);
+
+        std::string replayPath;
+        double replaySpeed = 1.0;
+        uint64_t replayStartTime = 0;
+
+        //node info responses of the recording, answered on every node info request
+        std::vector<CANRecord::Frame_t> nodeInfos;
+        std::mutex callbackMtx;
+
+        std::atomic_bool done = false;
+        std::thread replayThread;
+
+    public:
+        CANDriverReplay(std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback,
+                        std::function<void(std::string *)> onErrorCallback, Config &config);
+        ~CANDriverReplay();
+
+        /**
+         * starts playing the recording on its own thread, does nothing if the replay was started already
+         */
+        void Start();
+
+        void SendCANMessage(uint32_t canBusChannelID, uint32_t canID, uint8_t *payload, uint32_t payloadLength, bool blocking);
+
+        std::map<std::string, bool> GetCANStatusReadable(uint32_t canBusChannelID);
+};
@@ -5,24 +5,57 @@
 #include <functional>
 #include <string>
 #include <thread>
+#include <atomic>
 #include "common.h"
 #include "utility/Config.h"
 #include "CANDriver.h"
+#include "CANTransmitQueue.h"
 
 
+/**
+ * one raw socket per device of /CAN/DEVICE, the bus id is the index of the device
+ *
+ * by default a single receive thread waits on all sockets with epoll, with receive_thread_per_bus each bus gets
+ * its own receive thread, receive_thread_cores optionally pins the receive threads (one core per thread, -1 for
+ * no pinning)
+ *
+ * frames are sent from a transmit thread per bus, frames queued in the meantime go out with one sendmmsg call
+ */
 class CANDriverSocketCAN : public CANDriver
 {
     private:
-		void receiveLoop();
-		bool done = false;
-		std::thread* receiveThread;
+		typedef struct
+		{
+			std::string device;
+			uint8_t canBusChannelID;
+			int socket;
+		} Bus_t;
+
+		void receiveLoop(std::vector<Bus_t *> receiveBuses, int core);
+		bool receiveBatch(Bus_t *bus, struct mmsghdr *msgs, struct canfd_frame *frames, CANFrame_t *batch);
+		int openSocket(const std::string &device);
+		std::atomic_bool done = false;
+		std::vector<std::thread> receiveThreads;
 
 		std::vector<std::string> canDevices;
-		int canSocket;
+		std::vector<Bus_t> buses;
+
+		//frames read with one recvmmsg call at most
+		uint32_t receiveBatchSize = 64;
+		//prefer the timestamp of the can controller if the interface provides one, it is not necessarily unix time
+		bool useHardwareTimestamps = false;
+		bool receiveThreadPerBus = false;
+		std::vector<int> receiveThreadCores;
+
+		CANTransmitQueue *transmitQueue = nullptr;
+		void sendBatch(uint32_t canBusChannelID, std::span<TxFrame_t> frames);
+
+		uint64_t getTimestamp(struct msghdr &msg);
 
     public:
         CANDriverSocketCAN(std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback,
-					   	   std::function<void(std::string *)> onErrorCallback, Config &config);
+					   	   std::function<void(std::string *)> onErrorCallback, Config &config,
+					   	   std::function<void(std::span<CANFrame_t>, CANDriver *driver)> onRecvBatchCallback = nullptr);
         ~CANDriverSocketCAN();
 
         void SendCANMessage(uint32_t canBusChannelID, uint32_t canID, uint8_t *payload, uint32_t payloadLength, bool blocking);
@@ -10,6 +10,7 @@
 #include "utility/Config.h"
 #include "CANDriver.h"
 #include "driver/UDPSocket.h"
+#include "can_houbolt/can_cmds.h"
 
 class CANDriverUDP : public CANDriver
 {
@@ -42,13 +43,28 @@ private:
     std::vector<uint32_t> nodeIDs;
     std::vector<uint32_t> canMsgSizes;
     uint32_t totalRequiredMsgPayloadSize = 0;
-    const uint32_t MSG_HEADER_SIZE = 0;
-    const uint32_t CAN_MSG_HEADER_SIZE = 1;
+    static constexpr uint32_t MSG_HEADER_SIZE = 0;
+    static constexpr uint32_t CAN_MSG_HEADER_SIZE = 1;
+    //info and command id of a can message, written in front of the block data
+    static constexpr uint32_t FRAME_HEADER_SIZE = sizeof(Can_MessageDataInfo_t) + sizeof(uint8_t);
+    //room in front of a datagram for the frame header of the first block
+    static constexpr uint32_t FRAME_HEADROOM = FRAME_HEADER_SIZE - CAN_MSG_HEADER_SIZE;
+    static constexpr size_t RECEIVE_BATCH_SIZE = 16;
+
+    //slots of headroom, datagram and a zeroed frame behind it, so frames read past their block stay in the buffer
+    std::vector<uint8_t> receiveBuffer;
+    size_t receiveSlotSize = 0;
+    bool hexdump = false;
 
     std::thread *asyncListenThread;
 
     void Close();
     void AsyncListen();
+    /**
+     * hands the used blocks to the receive callback as views into the datagram, the frame header of each block
+     * overwrites its option byte and the end of the block before, which is already processed at that point
+     */
+    void ProcessDatagram(uint8_t *data, size_t dataLength, uint64_t timestamp);
 
 public:
     CANDriverUDP(std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback,
@@ -1,15 +1,23 @@
 #pragma once
 
 #include <atomic>
+#include <array>
 #include <map>
+#include <condition_variable>
 #include <functional>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 #include "common.h"
 #include "utility/Singleton.h"
 #include "utility/Config.h"
 #include "can/Node.h"
 #include "can/CANMapping.h"
+#include "can/CANRecorder.h"
+#include "can/CANDriverReplay.h"
+#include "can/CANRejectStats.h"
 
 
 typedef struct
@@ -31,14 +39,13 @@ typedef struct
 //channelData_t sensorBuffer[];
 
 
-//TODO: MP guarantee that nodeMap is read only after initialization process
 /**
  * read node channel mapping on init
  * save scaling
  * read sensor data, convert from byte array to integer
  * then scale sensor data, and add padding to extend to 32 bits
- * write into sensor buffer (its a ring buffer)
- * log same data to database in different thread
+ * write into sensor ring buffer of the node
+ * the sensor log thread reads every ring with its own SensorRingReader and logs the samples to the database
  *
  * channel scaling is constant and channel specific
  */
@@ -49,11 +56,38 @@ class CANManager : public Singleton<CANManager>
 	private:
 
 		
-		CANDriver *loraDriver;
+		CANDriver *loraDriver = nullptr;
+		//same driver as canDriver if the can traffic is replayed from a recording, started once initialized
+		CANDriverReplay *replayDriver = nullptr;
 		CANMapping *mapping;
+		CANRecorder *recorder = nullptr;
 
+		typedef struct
+		{
+			uint8_t canBusChannelID;
+			uint8_t nodeID;
+			NodeInfoMsg_t nodeInfo;
+			CANDriver *driver;
+		} DiscoveredNode_t;
+
+		//node discovery, the receive threads only collect node infos, Init constructs the nodes
 		std::mutex nodeMapMtx;
+		std::condition_variable nodeDiscoveredCV;
 		std::map<uint8_t, Node *> nodeMap;
+		//every node info received, key is the node id
+		std::map<uint8_t, DiscoveredNode_t> nodeInventory;
+		//nodes of the inventory file of the last run, only used to end the discovery early and report changed or missing nodes
+		std::map<uint8_t, DiscoveredNode_t> expectedNodes;
+		//ids of nodes in nodeInventory that are not constructed yet
+		std::vector<uint8_t> pendingNodeIDs;
+		//set before the last nodes are constructed, later node infos are only compared with the inventory
+		bool discoveryClosed = false;
+		//empty if no inventory is cached
+		std::string nodeInventoryPath;
+		//indexed by node id, copied from nodeMap once the initialization is done and read only afterwards
+		std::array<Node *, 256> nodeTable{};
+		//received frames dropped after the initialization, printed by the PrintCANStats command
+		CANRejectStats rejectStats;
 
 		/**
 		 * key: nodeId << 8 | channelId
@@ -62,6 +96,10 @@ class CANManager : public Singleton<CANManager>
 		std::map<uint16_t, std::tuple<std::string, std::vector<double>>> sensorInfoMap;
 
 		std::atomic_bool initialized = false;
+
+		//formats the samples of the node rings into the fast logger, so the receive threads only decode
+		std::thread sensorLogThread;
+		std::atomic_bool sensorLogDone = false;
 		std::atomic_bool useLora = false;
 
 		std::vector<int> nodeIDsRefInt= std::vector<int>();
@@ -71,9 +109,23 @@ class CANManager : public Singleton<CANManager>
 		static inline uint8_t GetNodeID(uint32_t &canID);
 		static inline uint16_t MergeNodeIDAndChannelID(uint8_t &nodeId, uint8_t &channelId);
 
-		void InitializeNode(uint8_t canBusChannelID, uint8_t nodeID, NodeInfoMsg_t *nodeInfo, CANDriver *driver);
+		void OnNodeInfo(uint8_t canBusChannelID, uint8_t nodeID, NodeInfoMsg_t *nodeInfo, CANDriver *driver);
+		std::vector<DiscoveredNode_t> TakePendingNodes();
+		/**
+		 * constructs the nodes in parallel, then registers their commands with the event manager
+		 */
+		void InitializeNodes(std::vector<DiscoveredNode_t> nodes);
+
+		/**
+		 * fills expectedNodes from the inventory file of the last run
+		 * @return false if there is no usable inventory with at least nodeCount nodes
+		 */
+		bool LoadNodeInventory(uint32_t nodeCount);
+		//requires nodeMapMtx
+		void SaveNodeInventory();
 
 		void RequestCurrentState();
+		void SensorLogLoop(std::vector<std::pair<Node *, SensorRingReader>> readers);
 
 		~CANManager();
 	public:
@@ -90,6 +142,10 @@ class CANManager : public Singleton<CANManager>
 
 		void OnChannelStateChanged(std::string stateName, double value, uint64_t timestamp);
 		void OnCANRecv(uint8_t canBusChannelID, uint32_t canID, uint8_t *payload, uint32_t payloadLength, uint64_t timestamp, CANDriver *canDriver);
+		/**
+		 * frames received by one driver call, an error in one frame doesn't discard the rest of the batch
+		 */
+		void OnCANRecvBatch(std::span<CANFrame_t> frames, CANDriver *canDriver);
 
 		//TODO: MP add error info to arguments
 		void OnCANError(std::string *error);
@@ -98,4 +154,5 @@ class CANManager : public Singleton<CANManager>
 
 		void ResetOffset(std::vector<double> &params, bool testOnly);
 		void FlushDatabase(std::vector<double> &params, bool testOnly);
+		void PrintCANStats(std::vector<double> &params, bool testOnly);
 };
@@ -0,0 +1,154 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#ifndef LLSERVER_ECUI_HOUBOLT_CANRECEIVEQUEUE_H
+#define LLSERVER_ECUI_HOUBOLT_CANRECEIVEQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+#include "common.h"
+
+/**
+ * bounded lock free queue of received frames with a single producer (the driver thread reading the hardware)
+ * and a single consumer (the thread processing the frames)
+ *
+ * the producer reads straight into a claimed slot, the consumer processes the frames in place and releases the slots
+ * afterwards, so a frame is never copied between the driver and the receive callback
+ */
+class CANReceiveQueue
+{
+public:
+    typedef struct
+    {
+        uint64_t timestamp;
+        uint32_t canID;
+        uint32_t payloadLength;
+        uint8_t payload[64];
+    } Slot_t;
+
+private:
+    std::unique_ptr<Slot_t[]> slots;
+    uint64_t capacity;
+    uint64_t mask;
+
+    //next slot to publish, only written by the producer
+    alignas(64) std::atomic_uint64_t tail = 0;
+    uint64_t cachedHead = 0;
+    //next slot to release, only written by the consumer
+    alignas(64) std::atomic_uint64_t head = 0;
+    uint64_t cachedTail = 0;
+    //rung by the producer once per burst instead of per frame, the consumer sleeps on it
+    alignas(64) std::atomic_uint32_t doorbell = 0;
+
+public:
+    /**
+     * @param capacity number of frames, rounded up to the next power of two
+     */
+    explicit CANReceiveQueue(uint64_t capacity)
+    {
+        if (capacity == 0)
+        {
+            throw std::runtime_error("CANReceiveQueue: capacity must be greater than 0");
+        }
+        this->capacity = 1;
+        while (this->capacity < capacity)
+        {
+            this->capacity <<= 1;
+        }
+        mask = this->capacity - 1;
+        slots = std::make_unique<Slot_t[]>(this->capacity);
+    }
+
+    CANReceiveQueue(const CANReceiveQueue &) = delete;
+    CANReceiveQueue &operator=(const CANReceiveQueue &) = delete;
+
+    /**
+     * NOTE: producer only
+     * @return the next free slot, nullptr if the queue is full, only visible to the consumer after Publish
+     */
+    inline Slot_t *Claim()
+    {
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        if (pos - cachedHead >= capacity)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (pos - cachedHead >= capacity)
+            {
+                return nullptr;
+            }
+        }
+        return &slots[pos & mask];
+    }
+
+    /**
+     * NOTE: producer only, publishes the slot returned by the last Claim
+     */
+    inline void Publish()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * wakes the consumer if it is waiting, call after publishing a burst of frames
+     */
+    inline void Notify()
+    {
+        doorbell.fetch_add(1, std::memory_order_release);
+        doorbell.notify_one();
+    }
+
+    /**
+     * NOTE: consumer only
+     * @return number of published frames not released yet
+     */
+    inline uint64_t Available()
+    {
+        if (cachedTail == head.load(std::memory_order_relaxed))
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+        }
+        return cachedTail - head.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * NOTE: consumer only, blocks until frames are available, or stop is set and Notify called
+     * @return number of available frames, may be 0 after a Notify without new frames
+     */
+    inline uint64_t Wait(const std::atomic_bool &stop)
+    {
+        // read the doorbell before checking for frames and stop, setting either in between rings it again
+        uint32_t bell = doorbell.load(std::memory_order_acquire);
+        uint64_t available = Available();
+        if (available == 0 && !stop.load(std::memory_order_acquire))
+        {
+            doorbell.wait(bell, std::memory_order_acquire);
+            available = Available();
+        }
+        return available;
+    }
+
+    /**
+     * NOTE: consumer only
+     * @param index 0 is the oldest available frame
+     */
+    inline Slot_t &Peek(uint64_t index)
+    {
+        return slots[(head.load(std::memory_order_relaxed) + index) & mask];
+    }
+
+    /**
+     * NOTE: consumer only, hands the oldest count slots back to the producer
+     */
+    inline void Release(uint64_t count)
+    {
+        head.store(head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    uint64_t GetCapacity() const
+    { return capacity; };
+};
+
+#endif //LLSERVER_ECUI_HOUBOLT_CANRECEIVEQUEUE_H
@@ -0,0 +1,244 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#ifndef LLSERVER_ECUI_HOUBOLT_CANRECORDER_H
+#define LLSERVER_ECUI_HOUBOLT_CANRECORDER_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "utility/Singleton.h"
+#include "utility/Config.h"
+
+/**
+ * on disk format of the can flight recorder, a recording is a directory with
+ *  can_traffic.<part>.canrec   memory mapped, append only segments of raw frames
+ *  can_traffic.canidx          sparse time index into the segments
+ *
+ * a segment starts with a SegmentHeader_t, followed by frames of [FrameHeader_t, payload padded to 8 bytes],
+ * a frame with committed == 0 ends the segment (not written yet or torn by a crash)
+ */
+namespace CANRecord
+{
+    constexpr uint64_t SEGMENT_MAGIC = 0x4345524e4143534c; // "LSCANREC"
+    constexpr uint32_t VERSION = 1;
+    constexpr std::size_t SEGMENT_HEADER_SIZE = 64;
+    constexpr std::size_t MAX_PAYLOAD_LENGTH = 64;
+
+    //frame was received by the lora driver, its bus ids overlap with the can buses
+    constexpr uint8_t FLAG_LORA = 0x01;
+
+    typedef struct
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t part;
+        //unix time in microseconds the segment was created
+        uint64_t created;
+    } SegmentHeader_t;
+
+    typedef struct
+    {
+        uint64_t timestamp;
+        uint32_t canID;
+        uint8_t canBusChannelID;
+        uint8_t flags;
+        uint8_t payloadLength;
+        //written last, 0 while the frame is still being copied
+        uint8_t committed;
+    } FrameHeader_t;
+
+    typedef struct
+    {
+        uint64_t timestamp;
+        uint64_t offset;
+        uint32_t part;
+        uint32_t reserved;
+    } IndexEntry_t;
+
+    typedef struct
+    {
+        uint64_t timestamp;
+        uint32_t canID;
+        uint8_t canBusChannelID;
+        uint8_t flags;
+        uint8_t payloadLength;
+        uint8_t payload[MAX_PAYLOAD_LENGTH];
+    } Frame_t;
+
+    inline std::size_t FrameSize(std::size_t payloadLength)
+    {
+        return sizeof(FrameHeader_t) + ((payloadLength + 7) & ~(std::size_t) 7);
+    }
+
+    std::string SegmentPath(const std::string &dirPath, uint32_t part);
+    std::string IndexPath(const std::string &dirPath);
+}
+
+/**
+ * records every raw frame passed to CANManager::OnCANRecv, independent of node initialization and decoding
+ * appending a frame is one atomic reservation and a memcpy into the mapped segment, so any number of
+ * receive threads can record concurrently, the page cache writes it back to disk
+ * the recording is rotated into the log directory of every sequence
+ */
+class CANRecorder : public Singleton<CANRecorder>
+{
+    friend class Singleton;
+
+private:
+    typedef struct
+    {
+        int fd;
+        char *data;
+        std::size_t size;
+        uint32_t part;
+        std::atomic_uint64_t writeOffset;
+        //end of the last frame that fit, set by the frame that overflowed the segment
+        std::atomic_uint64_t usedBytes;
+    } Segment_t;
+
+    bool enabled = false;
+    std::size_t segmentSize = 256 * 1024 * 1024;
+    uint64_t indexInterval = 10000;
+
+    //shared by the recording threads, exclusive for rotating to a new segment or directory
+    std::shared_mutex segmentMtx;
+    Segment_t *segment = nullptr;
+    std::string dirPath;
+
+    std::mutex indexMtx;
+    FILE *indexFile = nullptr;
+    std::atomic_uint64_t nextIndexTimestamp = 0;
+
+    std::atomic_uint64_t recordedFrames = 0;
+    std::atomic_uint64_t droppedFrames = 0;
+
+    Segment_t *OpenSegment(uint32_t part);
+    void CloseSegment(Segment_t *closedSegment);
+    void NextSegment(Segment_t *fullSegment);
+    void CloseRecording();
+
+    ~CANRecorder();
+
+public:
+    /**
+     * reads the optional CAN keys enable_recorder, recorder_segment_size and recorder_index_interval and starts
+     * recording into logs/<date> if enabled
+     */
+    void Init(Config &config);
+
+    /**
+     * closes the current recording and continues in dirPath, does nothing if the recorder is disabled
+     */
+    void Rotate(const std::string &dirPath);
+    void Stop();
+
+    inline void Record(uint8_t canBusChannelID, uint32_t canID, const uint8_t *payload, uint32_t payloadLength, uint64_t timestamp, uint8_t flags = 0)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        if (payloadLength > CANRecord::MAX_PAYLOAD_LENGTH)
+        {
+            droppedFrames++;
+            return;
+        }
+        std::size_t size = CANRecord::FrameSize(payloadLength);
+
+        while (true)
+        {
+            std::shared_lock<std::shared_mutex> lock(segmentMtx);
+            Segment_t *current = segment;
+            if (current == nullptr)
+            {
+                return;
+            }
+
+            uint64_t offset = current->writeOffset.fetch_add(size, std::memory_order_relaxed);
+            if (offset + size > current->size)
+            {
+                if (offset <= current->size)
+                {
+                    current->usedBytes.store(offset, std::memory_order_relaxed);
+                }
+                lock.unlock();
+                NextSegment(current);
+                continue;
+            }
+
+            CANRecord::FrameHeader_t *frame = (CANRecord::FrameHeader_t *) &current->data[offset];
+            frame->timestamp = timestamp;
+            frame->canID = canID;
+            frame->canBusChannelID = canBusChannelID;
+            frame->flags = flags;
+            frame->payloadLength = payloadLength;
+            std::memcpy(&current->data[offset + sizeof(CANRecord::FrameHeader_t)], payload, payloadLength);
+            std::atomic_ref<uint8_t>(frame->committed).store(1, std::memory_order_release);
+
+            uint64_t indexTimestamp = nextIndexTimestamp.load(std::memory_order_relaxed);
+            if (timestamp >= indexTimestamp
+                && nextIndexTimestamp.compare_exchange_strong(indexTimestamp, timestamp + indexInterval, std::memory_order_relaxed))
+            {
+                CANRecord::IndexEntry_t entry = {timestamp, offset, current->part, 0};
+                std::lock_guard<std::mutex> indexLock(indexMtx);
+                fwrite(&entry, sizeof(entry), 1, indexFile);
+            }
+
+            recordedFrames.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    uint64_t GetRecordedFrames();
+    uint64_t GetDroppedFrames();
+};
+
+/**
+ * sequential reader of a recording written by CANRecorder
+ */
+class CANRecordReader
+{
+private:
+    std::string dirPath;
+    std::vector<CANRecord::IndexEntry_t> index;
+
+    int fd = -1;
+    const char *data = nullptr;
+    std::size_t size = 0;
+    uint32_t part = 0;
+    std::size_t offset = 0;
+
+    bool OpenPart(uint32_t newPart);
+    void ClosePart();
+
+public:
+    explicit CANRecordReader(std::string dirPath);
+    CANRecordReader(const CANRecordReader &) = delete;
+    ~CANRecordReader();
+
+    /**
+     * @return false if the recording has no segment
+     */
+    bool Open();
+
+    /**
+     * positions the reader at the last indexed frame before timestamp, frames are only approximately ordered in
+     * time across buses, so Next can return a few frames older than timestamp
+     */
+    void Seek(uint64_t timestamp);
+
+    /**
+     * @return false once every committed frame of every segment was read
+     */
+    bool Next(CANRecord::Frame_t &frame);
+};
+
+#endif //LLSERVER_ECUI_HOUBOLT_CANRECORDER_H
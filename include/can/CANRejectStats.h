@@ -0,0 +1,67 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#ifndef LLSERVER_ECUI_HOUBOLT_CANREJECTSTATS_H
+#define LLSERVER_ECUI_HOUBOLT_CANREJECTSTATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include "common.h"
+
+enum class CANRejectReason : uint8_t
+{
+    NONE = 0,
+    UNKNOWN_NODE,
+    EMPTY_PAYLOAD,
+    UNKNOWN_CHANNEL,
+    INVALID_SENSOR_FRAME,
+    COUNT
+};
+
+/**
+ * counts received frames that are dropped because they can't be processed, without throwing
+ * each reason is logged at most once per second with one example frame and the number of frames
+ * dropped since, so a misconfigured node flooding the bus costs a counter increment per frame
+ */
+class CANRejectStats
+{
+private:
+    typedef struct
+    {
+        std::atomic_uint64_t count;
+        std::atomic_uint64_t loggedCount;
+        //steady clock in nanoseconds, before it the reason isn't logged again
+        std::atomic_int64_t nextLogTime;
+    } Counter_t;
+
+    static constexpr int64_t LOG_INTERVAL = 1000000000;
+
+    std::array<Counter_t, (size_t) CANRejectReason::COUNT> counters{};
+
+    void LogRejection(CANRejectReason reason, uint8_t canBusChannelID, uint32_t canID, const uint8_t *payload, uint32_t payloadLength, int64_t now);
+
+public:
+    inline void Reject(CANRejectReason reason, uint8_t canBusChannelID, uint32_t canID, const uint8_t *payload, uint32_t payloadLength)
+    {
+        Counter_t &counter = counters[(size_t) reason];
+        counter.count.fetch_add(1, std::memory_order_relaxed);
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (now >= counter.nextLogTime.load(std::memory_order_relaxed))
+        {
+            LogRejection(reason, canBusChannelID, canID, payload, payloadLength, now);
+        }
+    }
+
+    uint64_t GetCount(CANRejectReason reason);
+    static const char *GetReasonName(CANRejectReason reason);
+
+    /**
+     * prints the number of frames rejected for every reason
+     */
+    void Print();
+};
+
+#endif //LLSERVER_ECUI_HOUBOLT_CANREJECTSTATS_H
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <span>
+#include "common.h"
+
+enum class TxPriority : uint8_t
+{
+	URGENT = 0, // aborts, sent before any queued normal frame of the bus
+	NORMAL = 1
+};
+
+typedef struct
+{
+	uint32_t canID;
+	uint32_t payloadLength;
+	bool blocking;
+	uint8_t payload[64];
+} TxFrame_t;
+
+/**
+ * per bus queues of frames to transmit, each bus has a thread that takes every frame queued so far (urgent first)
+ * and hands them to the driver as one batch, so callers never wait for the bus
+ *
+ * the priority of pushed frames is set per thread with a PriorityScope
+ */
+class CANTransmitQueue
+{
+	public:
+		typedef std::function<void(uint32_t canBusChannelID, std::span<TxFrame_t> frames)> SendFunction;
+
+		/**
+		 * sets the priority of every frame pushed by the current thread while it exists
+		 */
+		class PriorityScope
+		{
+			private:
+				TxPriority previous;
+
+			public:
+				explicit PriorityScope(TxPriority priority) : previous(currentPriority)
+				{ currentPriority = priority; };
+				~PriorityScope()
+				{ currentPriority = previous; };
+				PriorityScope(const PriorityScope &) = delete;
+		};
+
+	private:
+		typedef struct
+		{
+			uint32_t canBusChannelID;
+			std::mutex mtx;
+			std::condition_variable cv;
+			std::deque<TxFrame_t> queues[2];
+			std::thread thread;
+		} BusQueue_t;
+
+		static thread_local TxPriority currentPriority;
+
+		SendFunction send;
+		const size_t maxQueued;
+		const size_t maxBatch;
+		//indexed by bus id, nullptr for buses without a queue
+		std::vector<std::unique_ptr<BusQueue_t>> buses;
+		std::atomic_bool stopping = false;
+		std::atomic_uint64_t failedFrames = 0;
+
+		void transmitLoop(BusQueue_t *bus);
+
+	public:
+		/**
+		 * @param send called from the transmit thread of the bus, may block, throws if the frames couldn't be sent
+		 */
+		CANTransmitQueue(const std::vector<uint32_t> &canBusChannelIDs, SendFunction send, size_t maxQueued, size_t maxBatch);
+		CANTransmitQueue(const CANTransmitQueue &) = delete;
+		/**
+		 * sends the frames still queued before returning
+		 */
+		~CANTransmitQueue();
+
+		/**
+		 * throws if the bus has no queue or, for normal frames, the queue is full
+		 * urgent frames are queued regardless of the limit
+		 */
+		void Push(uint32_t canBusChannelID, uint32_t canID, const uint8_t *payload, uint32_t payloadLength, bool blocking);
+
+		uint64_t GetFailedFrames();
+};
@@ -14,6 +14,7 @@
 #include <can_houbolt/cmds.h>
 #include <limits.h>
 #include <atomic>
+#include <string_view>
 
 #include "StateController.h"
 #include "can_houbolt/cmds.h"
@@ -27,6 +28,9 @@ private:
     static const std::vector<std::string> states;
     static const std::map<std::string, std::vector<double>> sensorScalingMap;
 
+    //incremented on every scaling change of any channel, so decode plans know when to rebuild
+    static std::atomic_uint64_t scalingGeneration;
+
 protected:
 
     const std::string channelTypeName = "undefined";
@@ -39,6 +43,11 @@ protected:
 
     std::map<std::string, command_t> commandMap;
 
+    //state name without channel prefix -> state id, written once in RegisterStates
+    std::map<std::string, state_id_t, std::less<>> stateIDMap;
+
+    void InitStateIDs(const std::vector<std::string> &states);
+
     //-------------------------------INLINE Functions-------------------------------//
 
     static inline double ScaleSensor(double value, double a, double b)
@@ -112,12 +121,20 @@ protected:
         return this->channelName + ":";
     }
 
-    inline void SetState(const std::string &stateName, const double &value, uint64_t &timestamp)
+    inline void SetState(std::string_view stateName, const double &value, uint64_t &timestamp)
     {
-        std::string prefix = GetStatePrefix();
         StateController *controller = StateController::Instance();
-        //set new state value
-        controller->SetState(prefix + stateName, value, timestamp);
+        auto it = stateIDMap.find(stateName);
+        if (it != stateIDMap.end())
+        {
+            //set new state value
+            controller->SetState(it->second, value, timestamp);
+        }
+        else
+        {
+            //state not registered by this channel, fall back to name lookup
+            controller->SetState(GetStatePrefix() + std::string(stateName), value, timestamp);
+        }
     }
 
     //-------------------------------RECEIVE Functions-------------------------------//
@@ -128,11 +145,11 @@ protected:
                                 const std::map<std::string, std::vector<double>> &scalingMap)
     {
         SetMsg_t *setMsg = (SetMsg_t *) canMsg->bit.data.uint8;
-        std::string variableStateName = variableMap.at((VAR)(setMsg->variable_id));
+        const std::string &variableStateName = variableMap.at((VAR)(setMsg->variable_id));
 
         Debug::info("Received variable %s of channel %s", variableStateName.c_str(), channelName.c_str());
         //convert and scale
-        std::vector<double> scalingParams = scalingMap.at(variableStateName);
+        const std::vector<double> &scalingParams = scalingMap.at(variableStateName);
         double value = ScaleToDouble((double)(setMsg->value), scalingParams[0], scalingParams[1]);
 
         //set new state value
@@ -184,10 +201,21 @@ public:
     { std::lock_guard<std::mutex> lock(scalingMtx); return this->sensorScaling; };
 
     virtual void SetScaling(std::vector<double> &sensorScaling)
-    { std::lock_guard<std::mutex> lock(scalingMtx); this->sensorScaling = sensorScaling; };
+    { std::lock_guard<std::mutex> lock(scalingMtx); this->sensorScaling = sensorScaling; scalingGeneration++; };
+
+    static uint64_t GetScalingGeneration()
+    { return scalingGeneration.load(std::memory_order_acquire); };
+
+    uint8_t GetTypeSize()
+    { return this->typeSize; };
 
     virtual std::vector<std::string> GetStates();
 
+    /**
+     * adds the states of the channel to the state controller and caches their state ids
+     */
+    virtual void RegisterStates();
+
     virtual std::map<std::string, command_t> GetCommands();
 
     virtual std::string GetSensorName()
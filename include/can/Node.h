@@ -7,6 +7,8 @@
 
 #include <mutex>
 #include <atomic>
+#include <array>
+#include <span>
 
 #include "common.h"
 
@@ -16,6 +18,41 @@ typedef struct
     uint64_t timestamp;
 } SensorData_t;
 
+/**
+ * latest value of a single channel, guarded by a sequence counter instead of a mutex
+ * there must only be one writer per slot (the receive thread of the can bus the node is attached to),
+ * readers retry until they get a consistent value and timestamp pair and never block the writer
+ */
+struct alignas(64) SensorSlot_t
+{
+    std::atomic_uint32_t sequence = 0;
+    std::atomic<double> value = 0;
+    std::atomic_uint64_t timestamp = 0;
+
+    inline void Write(double newValue, uint64_t newTimestamp)
+    {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        value.store(newValue, std::memory_order_relaxed);
+        timestamp.store(newTimestamp, std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    inline void Read(double &currValue, uint64_t &currTimestamp) const
+    {
+        uint32_t seqBefore, seqAfter;
+        do
+        {
+            seqBefore = sequence.load(std::memory_order_acquire);
+            currValue = value.load(std::memory_order_relaxed);
+            currTimestamp = timestamp.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            seqAfter = sequence.load(std::memory_order_relaxed);
+        } while ((seqBefore & 1) || seqBefore != seqAfter);
+    }
+};
+
 //TODO: move to can_houbolt headers
 typedef struct __attribute__((__packed__))
 {
@@ -24,6 +61,8 @@ typedef struct __attribute__((__packed__))
 } SensorMsg_t;
 
 #include "can/Channel.h"
+#include "can/SensorRingBuffer.h"
+#include "can/SensorDecodePlan.h"
 #include "CANDriverKvaser.h"
 #include "can_houbolt/channels/generic_channel_def.h"
 #include "logging/InfluxDbLogger.h"
@@ -39,24 +78,40 @@ private:
     static const std::map<GENERIC_VARIABLES, std::string> variableMap;
 	
     static bool enableFastLogging;
+    //one data point per sensor frame tagged with the node name instead of one per channel
+    static bool enableWideRowLogging;
 	static std::string influxIP;
 	static int influxPort;
 	static std::string databaseName;
 	static std::string measurementName;
 	static int influxBufferSize;
+	static InfluxDbWriterOptions influxOptions;
+	static uint64_t sensorRingBufferSize;
 
     static InfluxDbLogger *logger;
-    static std::mutex loggerMtx;
 
 private:
     uint8_t canBusChannelID = 0;
 	uint8_t nodeID = 0;
     uint32_t firwareVersion = 0;
 	std::map<uint8_t, Channel *> channelMap;
+    //same channels indexed by channel id, nullptr for unused ids
+    std::array<Channel *, 32> channelTable{};
     CANDriver* driver;
-    SensorData_t *latestSensorBuffer;
-    size_t latestSensorBufferLength = 0;
-    std::mutex bufferMtx;
+    //indexed by channel id
+    std::array<SensorSlot_t, 32> latestSensorSlots;
+    //channel id and sensor name of every channel, built once after the channels are initialized
+    std::vector<std::pair<uint8_t, std::string>> sensorNames;
+    //precomputed line protocol prefix of every channel for fast sensor logging, indexed by channel id
+    std::array<std::string, 32> sensorSeriesKeys;
+    //wide row logging: series key of the node and field key of every channel, indexed by channel id
+    std::string nodeSeriesKey;
+    std::array<std::string, 32> sensorFieldKeys;
+    //every decoded sample at full rate, consumers attach with their own SensorRingReader, the fast logger reads it
+    //on the sensor log thread of the CANManager
+    SensorRingBuffer sensorRing;
+    //layout of the sensor frames, built with the channels and rebuilt if a frame has a different mask or a scaling changed
+    SensorDecodePlan decodePlan;
 
 	void InitChannels(NodeInfoMsg_t &nodeInfo, std::map<uint8_t, std::tuple<std::string, std::vector<double>>> &channelInfo);
 
@@ -84,18 +139,40 @@ public:
 	uint8_t GetCANBusChannelID();
 
     std::vector<std::string> GetStates() override;
+    void RegisterStates() override;
 	std::map<std::string, std::string> GetChannelTypeMap();
 	std::map<std::string, command_t> GetCommands() override;
-    std::map<std::string, std::tuple<double, uint64_t>> GetLatestSensorData();
+    /**
+     * copies the latest value of every channel into the given buffer without allocating or locking
+     * @param buffer needs room for one entry per channel, 32 entries are always sufficient
+     * @return the filled part of the buffer, in the same order as the channels in channelMap
+     */
+    std::span<ChannelSensorData_t> GetLatestSensorData(std::span<ChannelSensorData_t> buffer);
+    void GetLatestSensorData(std::map<std::string, std::tuple<double, uint64_t>> &sensorData);
+    const std::string &GetChannelSensorName(uint8_t channelID);
+    const SensorRingBuffer *GetSensorRingBuffer();
 
 	//-------------------------------Utility Functions-------------------------------//
 
+	static bool IsFastLoggingEnabled();
 	static void FlushLogger();
+    /**
+     * formats the samples of the sensor ring the reader hasn't seen yet into the fast logger
+     * @param buffer scratch space, limits the number of samples per call
+     * @return number of samples read from the ring
+     */
+    size_t LogSensorSamples(SensorRingReader &reader, std::span<ChannelSensorData_t> buffer);
 	std::vector<double> ResetSensorOffset(std::vector<double> &params, bool testOnly) override;
 
     //-------------------------------RECEIVE Functions-------------------------------//
 
-    void ProcessSensorDataAndWriteToRingBuffer(Can_MessageData_t *canMsg, uint32_t &canMsgLength, uint64_t &timestamp);
+    /**
+     * @return NONE if the frame was decoded, otherwise why it was dropped, frames are rejected without throwing
+     */
+    CANRejectReason ProcessSensorDataAndWriteToRingBuffer(Can_MessageData_t *canMsg, uint32_t &canMsgLength, uint64_t &timestamp);
+
+    inline bool HasChannel(uint8_t channelID) const
+    { return channelID < channelTable.size() && channelTable[channelID] != nullptr; };
 
     void ProcessCANCommand(Can_MessageData_t *canMsg, uint32_t &canMsgLength, uint64_t &timestamp) override;
 
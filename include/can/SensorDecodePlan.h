@@ -0,0 +1,157 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#ifndef LLSERVER_ECUI_HOUBOLT_SENSORDECODEPLAN_H
+#define LLSERVER_ECUI_HOUBOLT_SENSORDECODEPLAN_H
+
+#include <array>
+#include <map>
+#include <span>
+
+#include "common.h"
+#include "can/CANRejectStats.h"
+#include "can/SensorScaling.h"
+
+class Channel;
+
+/**
+ * precompiled layout of the sensor frames of a node: byte offset, width and scaling of every channel in the
+ * channel mask, with consecutive channels of the same width grouped into runs
+ * decoding a frame is one loop per run without lookups, virtual calls or locks, runs of 16 and 24 bit channels
+ * are scaled with the SIMD batch functions of SensorScaling
+ *
+ * the raw values are read like Channel::GetSensorValue does: 1 and 2 bytes unsigned, 3 and 4 bytes signed
+ */
+class SensorDecodePlan
+{
+public:
+    static constexpr std::size_t MAX_CHANNELS = 32;
+
+private:
+    typedef struct
+    {
+        uint8_t first; //index of the first channel of the run
+        uint8_t count;
+        uint8_t width; //in bytes
+    } Run_t;
+
+    uint32_t channelMask = 0;
+    //scaling generation the plan was built with, see Channel::GetScalingGeneration
+    uint64_t scalingGeneration = 0;
+    bool valid = false;
+    //last mask that couldn't be planned, frames with it are rejected without rebuilding
+    uint32_t rejectedMask = 0;
+    uint64_t rejectedGeneration = 0;
+    CANRejectReason rejectReason = CANRejectReason::NONE;
+
+    std::size_t channelCount = 0;
+    std::size_t runCount = 0;
+    std::size_t dataLength = 0;
+    std::array<uint8_t, MAX_CHANNELS> channelIDs;
+    std::array<uint8_t, MAX_CHANNELS> byteOffsets;
+    std::array<double, MAX_CHANNELS> slopes;
+    std::array<double, MAX_CHANNELS> offsets;
+    std::array<Run_t, MAX_CHANNELS> runs;
+
+    template<uint8_t WIDTH>
+    static inline int32_t ReadRaw(const uint8_t *valuePtr)
+    {
+        if constexpr (WIDTH == 1)
+        {
+            return valuePtr[0];
+        }
+        else if constexpr (WIDTH == 2)
+        {
+            return valuePtr[1] << 8 | valuePtr[0];
+        }
+        else if constexpr (WIDTH == 3)
+        {
+            //sign extension of the 24 bit adc value
+            return (int32_t) ((uint32_t) (valuePtr[2] << 16 | valuePtr[1] << 8 | valuePtr[0]) << 8) >> 8;
+        }
+        else
+        {
+            return (int32_t) ((uint32_t) valuePtr[3] << 24 | valuePtr[2] << 16 | valuePtr[1] << 8 | valuePtr[0]);
+        }
+    }
+
+    template<uint8_t WIDTH>
+    static inline void DecodeRun(const uint8_t *data, const double *runSlopes, const double *runOffsets, double *values, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            values[i] = (double) ReadRaw<WIDTH>(data + i * WIDTH) * runSlopes[i] + runOffsets[i];
+        }
+    }
+
+    CANRejectReason Reject(uint32_t mask, uint64_t generation, CANRejectReason reason);
+
+public:
+    /**
+     * @return NONE, UNKNOWN_CHANNEL if a channel of the mask doesn't exist or INVALID_SENSOR_FRAME if a channel
+     * has an unsupported width or the data doesn't fit a frame, the plan is invalid afterwards
+     */
+    CANRejectReason Build(uint32_t mask, const std::map<uint8_t, Channel *> &channelMap, uint64_t generation);
+
+    inline bool Matches(uint32_t mask, uint64_t generation) const
+    {
+        return valid && mask == channelMask && generation == scalingGeneration;
+    }
+
+    /**
+     * @return the reason of the last failed Build if it was called with the same mask and generation, NONE otherwise
+     */
+    inline CANRejectReason GetRejectReason(uint32_t mask, uint64_t generation) const
+    {
+        if (rejectReason != CANRejectReason::NONE && mask == rejectedMask && generation == rejectedGeneration)
+        {
+            return rejectReason;
+        }
+        return CANRejectReason::NONE;
+    }
+
+    /**
+     * decodes and scales the channel data of a frame with the planned mask
+     * @param values needs room for GetChannelCount() values, MAX_CHANNELS are always sufficient
+     * @return the filled part of values, value i belongs to channel GetChannelID(i)
+     */
+    inline std::span<double> Decode(const uint8_t *data, std::span<double> values) const
+    {
+        for (std::size_t r = 0; r < runCount; r++)
+        {
+            const Run_t &run = runs[r];
+            const uint8_t *runData = data + byteOffsets[run.first];
+            switch (run.width)
+            {
+                case 1:
+                    DecodeRun<1>(runData, &slopes[run.first], &offsets[run.first], &values[run.first], run.count);
+                    break;
+                case 2:
+                    SensorScaling::ScaleADC16(runData, &slopes[run.first], &offsets[run.first], &values[run.first], run.count);
+                    break;
+                case 3:
+                    SensorScaling::ScaleADC24(runData, &slopes[run.first], &offsets[run.first], &values[run.first], run.count);
+                    break;
+                default:
+                    DecodeRun<4>(runData, &slopes[run.first], &offsets[run.first], &values[run.first], run.count);
+                    break;
+            }
+        }
+        return values.first(channelCount);
+    }
+
+    inline uint8_t GetChannelID(std::size_t index) const
+    { return channelIDs[index]; };
+
+    inline std::size_t GetChannelCount() const
+    { return channelCount; };
+
+    /**
+     * @return bytes of channel data in a frame with the planned mask
+     */
+    inline std::size_t GetDataLength() const
+    { return dataLength; };
+};
+
+#endif //LLSERVER_ECUI_HOUBOLT_SENSORDECODEPLAN_H
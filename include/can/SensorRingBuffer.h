@@ -0,0 +1,174 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#ifndef LLSERVER_ECUI_HOUBOLT_SENSORRINGBUFFER_H
+#define LLSERVER_ECUI_HOUBOLT_SENSORRINGBUFFER_H
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <stdexcept>
+
+#include "common.h"
+
+typedef struct
+{
+    uint8_t channelID;
+    double value;
+    uint64_t timestamp;
+} ChannelSensorData_t;
+
+class SensorRingReader;
+
+/**
+ * bounded lock free ring of decoded sensor samples with a single producer (the can receive thread of the node)
+ * and any number of independent readers, each reader owns its cursor so a slow reader never holds back the
+ * producer or other readers, it just gets overrun and counts the lost samples
+ */
+class SensorRingBuffer
+{
+    friend class SensorRingReader;
+
+private:
+    typedef struct
+    {
+        //2 * position + 1 while the slot is written, 2 * position + 2 once it is valid
+        std::atomic_uint64_t sequence;
+        std::atomic_uint8_t channelID;
+        std::atomic<double> value;
+        std::atomic_uint64_t timestamp;
+    } Slot_t;
+
+    std::unique_ptr<Slot_t[]> slots;
+    uint64_t capacity;
+    uint64_t mask;
+
+    //position of the next sample to be written, on its own cache line so readers polling it don't slow down the slots
+    alignas(64) std::atomic_uint64_t head = 0;
+
+public:
+    /**
+     * @param capacity number of samples, rounded up to the next power of two
+     */
+    explicit SensorRingBuffer(uint64_t capacity)
+    {
+        if (capacity == 0)
+        {
+            throw std::runtime_error("SensorRingBuffer: capacity must be greater than 0");
+        }
+        this->capacity = 1;
+        while (this->capacity < capacity)
+        {
+            this->capacity <<= 1;
+        }
+        mask = this->capacity - 1;
+        slots = std::make_unique<Slot_t[]>(this->capacity);
+        for (uint64_t i = 0; i < this->capacity; i++)
+        {
+            slots[i].sequence.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    SensorRingBuffer(const SensorRingBuffer &) = delete;
+    SensorRingBuffer &operator=(const SensorRingBuffer &) = delete;
+
+    /**
+     * NOTE: must only be called from the producer thread
+     */
+    inline void Push(uint8_t channelID, double value, uint64_t timestamp)
+    {
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        Slot_t &slot = slots[pos & mask];
+
+        slot.sequence.store(2 * pos + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.channelID.store(channelID, std::memory_order_relaxed);
+        slot.value.store(value, std::memory_order_relaxed);
+        slot.timestamp.store(timestamp, std::memory_order_relaxed);
+        slot.sequence.store(2 * pos + 2, std::memory_order_release);
+
+        head.store(pos + 1, std::memory_order_release);
+    }
+
+    uint64_t GetCapacity() const
+    { return capacity; };
+
+    /**
+     * @return total number of samples pushed since creation
+     */
+    uint64_t GetHead() const
+    { return head.load(std::memory_order_acquire); };
+};
+
+/**
+ * cursor of a single consumer into a SensorRingBuffer, not thread safe itself, each consumer thread needs its own
+ */
+class SensorRingReader
+{
+private:
+    const SensorRingBuffer *ring;
+    uint64_t cursor;
+    uint64_t overrunCount = 0;
+
+public:
+    /**
+     * starts reading at the current head, samples pushed before creation are not returned
+     */
+    explicit SensorRingReader(const SensorRingBuffer *ring) : ring(ring), cursor(ring->GetHead())
+    {};
+
+    /**
+     * copies the samples the reader has not seen yet into the buffer, oldest first
+     * samples overwritten before they could be read are skipped and added to the overrun count
+     * @return the filled part of the buffer, empty if there are no new samples
+     */
+    std::span<ChannelSensorData_t> Read(std::span<ChannelSensorData_t> buffer)
+    {
+        size_t count = 0;
+        while (count < buffer.size())
+        {
+            uint64_t head = ring->GetHead();
+            if (cursor >= head)
+            {
+                break;
+            }
+            if (head - cursor > ring->capacity)
+            {
+                overrunCount += head - cursor - ring->capacity;
+                cursor = head - ring->capacity;
+            }
+
+            const SensorRingBuffer::Slot_t &slot = ring->slots[cursor & ring->mask];
+            uint64_t seqBefore = slot.sequence.load(std::memory_order_acquire);
+            ChannelSensorData_t &sample = buffer[count];
+            sample.channelID = slot.channelID.load(std::memory_order_relaxed);
+            sample.value = slot.value.load(std::memory_order_relaxed);
+            sample.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t seqAfter = slot.sequence.load(std::memory_order_relaxed);
+
+            if (seqBefore != 2 * cursor + 2 || seqAfter != seqBefore)
+            {
+                //producer lapped us while reading this slot, resync on the next iteration
+                overrunCount++;
+                cursor++;
+                continue;
+            }
+            cursor++;
+            count++;
+        }
+        return buffer.first(count);
+    }
+
+    /**
+     * @return number of samples that have been pushed but not read yet, may exceed the capacity
+     */
+    uint64_t GetPending() const
+    { return ring->GetHead() - cursor; };
+
+    uint64_t GetOverrunCount() const
+    { return overrunCount; };
+};
+
+#endif //LLSERVER_ECUI_HOUBOLT_SENSORRINGBUFFER_H
@@ -0,0 +1,59 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#ifndef LLSERVER_ECUI_HOUBOLT_SENSORSCALING_H
+#define LLSERVER_ECUI_HOUBOLT_SENSORSCALING_H
+
+#include <cstddef>
+#include <vector>
+
+#include "common.h"
+
+/**
+ * batch conversion of the raw adc values of a sensor frame to scaled doubles, value[i] = raw[i] * slope[i] + offset[i]
+ * the implementation is picked once at runtime: AVX2 or SSE2 on x86-64, NEON on ARM64, scalar otherwise
+ * the vector implementations multiply and add separately like Channel::ScaleSensor, so they round the same
+ *
+ * raw points to count packed little endian values, no byte after them is read
+ */
+namespace SensorScaling
+{
+    typedef void (*ScaleFunction_t)(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count);
+
+    typedef struct
+    {
+        const char *name;
+        //unsigned 16 bit values
+        ScaleFunction_t scaleADC16;
+        //signed 24 bit values
+        ScaleFunction_t scaleADC24;
+    } Implementation_t;
+
+    /**
+     * @return the fastest implementation supported by the cpu
+     */
+    const Implementation_t &GetImplementation();
+
+    /**
+     * @return every implementation the cpu can run, fastest first, the scalar one last
+     */
+    const std::vector<const Implementation_t *> &GetSupportedImplementations();
+
+    /**
+     * @return the plain C++ implementation, reference for tests and benchmarks
+     */
+    const Implementation_t &GetScalarImplementation();
+
+    inline void ScaleADC16(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count)
+    {
+        GetImplementation().scaleADC16(raw, slopes, offsets, values, count);
+    }
+
+    inline void ScaleADC24(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count)
+    {
+        GetImplementation().scaleADC24(raw, slopes, offsets, values, count);
+    }
+}
+
+#endif //LLSERVER_ECUI_HOUBOLT_SENSORSCALING_H
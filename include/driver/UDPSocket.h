@@ -50,6 +50,12 @@ public:
 
     void Send(UDPMessage *msg);
     void Recv(UDPMessage *msg);
+    /**
+     * receives a burst of datagrams with one system call, blocks until at least one arrived
+     * data and dataLength of every message are a buffer and its capacity, dataLength is set to the received length
+     * @return number of received datagrams
+     */
+    size_t RecvBatch(UDPMessage *msgs, size_t count);
     // std::vector<uint8_t> RecvBytes();
     bool isConnectionActive();
     void Close();
@@ -1,9 +1,12 @@
 #ifndef INFLUXDBLOGGER_H
 #define INFLUXDBLOGGER_H
 
+#include <mutex>
+
 #include "logging/InfluxDbWriter.h"
 #include "logging/MessageLogger.h"
 #include "logging/DataLogger.h"
+#include "utility/json.hpp"
 
 class InfluxDbLogger
     : public MessageLogger, public DataLogger{
@@ -11,7 +14,12 @@ class InfluxDbLogger
             InfluxDbLogger();
             InfluxDbLogger(const InfluxDbLogger&) = delete;
             ~InfluxDbLogger();
-            void Init(std::string db_hostname, unsigned db_port, std::string db_name, std::string measurement, timestamp_precision_t precision, std::size_t buffer_size);
+            void Init(std::string db_hostname, unsigned db_port, std::string db_name, std::string measurement, timestamp_precision_t precision, std::size_t buffer_size, InfluxDbWriterOptions options = {});
+
+            /**
+             * reads the optional writer settings of the INFLUXDB config block, missing keys keep their defaults
+             */
+            static InfluxDbWriterOptions ReadOptions(const nlohmann::json &influxConfig);
 
             void log(std::string source, std::string msg, std::size_t timestamp, Severity severity);
             void log(std::string key, std::size_t value, std::size_t timestamp);
@@ -19,9 +27,24 @@ class InfluxDbLogger
             void log(std::string key, bool value, std::size_t timestamp);
             //template <typename T> void log(std::string key, T value, std::size_t timestamp);
 
+            /**
+             * precomputes the line protocol prefix of a key, so logging it only needs to format value and timestamp
+             */
+            std::string createSeriesKey(const std::string &key);
+            void logSeries(std::string_view seriesKey, double value, std::size_t timestamp);
+
+            /**
+             * series key and field keys for wide rows, one data point tagged with tagKey=tagValue and a field per value
+             */
+            std::string createSeriesKey(const std::string &tagKey, const std::string &tagValue);
+            std::string createFieldKey(const std::string &fieldKey);
+            void logSeries(std::string_view seriesKey, std::span<const std::string *> fieldKeys, std::span<const double> values, std::size_t timestamp);
+
             void flush();
         private:
             InfluxDbWriter *dbWriter;
+            //a data point is written with several writer calls, they must not interleave between threads
+            std::mutex logMtx;
 };
 
 #endif
\ No newline at end of file
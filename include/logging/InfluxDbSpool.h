@@ -0,0 +1,74 @@
+#ifndef INFLUXDBSPOOL_H
+#define INFLUXDBSPOOL_H
+
+#include <string>
+#include <cstdint>
+
+/**
+ * disk backed, append only segment for line protocol buffers that couldn't be sent
+ * the segment is a fixed size memory mapped file, so appending is a memcpy and survives a crash of the server
+ *
+ * layout: header, then records of [length, checksum, data padded to 8 bytes], a zero length ends the records
+ * on open the records after the persisted read offset are validated, everything after the first torn or
+ * corrupt record is discarded
+ *
+ * NOTE: not thread safe, only used by the writer thread of an InfluxDbWriter
+ */
+class InfluxDbSpool {
+    public:
+        InfluxDbSpool(std::string file_path, std::size_t max_size);
+        InfluxDbSpool(const InfluxDbSpool&) = delete;
+        ~InfluxDbSpool();
+
+        void open();
+
+        /**
+         * @return false if the segment is full, the data is lost then
+         */
+        bool append(const char *data, std::size_t length);
+
+        /**
+         * oldest record that has not been replayed yet
+         * @return false if the spool is empty
+         */
+        bool peek(const char *&data, std::size_t &length);
+        /**
+         * marks the record returned by peek as replayed, resets the segment once everything is replayed
+         */
+        void pop();
+
+        bool empty();
+        std::size_t getSpooledBytes();
+        std::size_t getDroppedBuffers();
+
+    private:
+        typedef struct {
+            uint64_t magic;
+            uint64_t read_offset;
+        } SpoolHeader_t;
+
+        typedef struct {
+            uint32_t length;
+            uint32_t checksum;
+        } RecordHeader_t;
+
+        static constexpr uint64_t SPOOL_MAGIC = 0x4c4f4f50534c4c01; // "LLSPOOL" + version
+        static constexpr std::size_t HEADER_SIZE = 64;
+
+        std::string file_path;
+        std::size_t max_size;
+        int fd = -1;
+        char *segment = nullptr;
+        std::size_t write_offset = HEADER_SIZE;
+        std::size_t dropped_buffers = 0;
+
+        SpoolHeader_t *header();
+        RecordHeader_t *recordAt(std::size_t offset);
+        static std::size_t recordSize(std::size_t length);
+        static uint32_t checksum(const char *data, std::size_t length);
+        void syncRange(std::size_t offset, std::size_t length);
+        void reset();
+        void recover();
+};
+
+#endif
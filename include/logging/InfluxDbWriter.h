@@ -2,48 +2,158 @@
 #define INFLUXDBWRITER_H
 
 #include <string>
+#include <string_view>
+#include <span>
 #include <thread>
 #include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <chrono>
+
+#include "logging/InfluxDbSpool.h"
 
 extern "C" {
     #include "logging/influxDb.h"
 }
 
+/**
+ * what happens to a full buffer if every buffer of the pool is still queued for sending
+ */
+enum class OverflowPolicy {
+    DROP,   // the oldest queued buffer is discarded and reused, the producer never waits
+    BLOCK   // the producer waits until the writer thread returned a buffer to the pool
+};
+
+struct InfluxDbWriterOptions {
+    std::size_t buffer_amount = 8;
+    OverflowPolicy overflow_policy = OverflowPolicy::DROP;
+    //0 sends uncompressed, 1 (fastest) to 9 (smallest) sends with Content-Encoding gzip
+    int gzip_level = 0;
+    //buffers that can't be sent are spooled to <spool_directory>/<db>_<measurement>.spool and replayed once
+    //the server is reachable again, empty disables spooling and drops them
+    std::string spool_directory;
+    std::size_t spool_max_size = 64 * 1024 * 1024;
+    //upper bound of replayed bytes per second, so the backlog doesn't starve live data
+    std::size_t spool_replay_rate = 1024 * 1024;
+};
+
+struct z_stream_s;
+
 class InfluxDbWriter {
     public:
-        // Might want to make the buffer size and concurrency configurable (DB)
-        InfluxDbWriter(std::string hostname, unsigned port, std::string dbName, std::size_t buffer_size);
+        InfluxDbWriter(std::string hostname, unsigned port, std::string dbName, std::size_t buffer_size, InfluxDbWriterOptions options = {});
         InfluxDbWriter(const InfluxDbWriter&) = delete;
         ~InfluxDbWriter();
+        /**
+         * starts the writer thread, the connection settings below must be set before
+         */
         void Init();
         void setCredentials(std::string user, std::string password);
         void setTimestampPrecision(timestamp_precision_t precision);
 
-        void setMeasurement(std::string measurement);
+        void setMeasurement(const std::string &measurement);
         void startDataPoint();
-        void addTag(std::string key, std::string value);
+        void addTag(const std::string &key, const std::string &value);
         void tagsDone();
-        void addField(std::string key, std::string value);
-        void addField(std::string key, std::size_t value);
-        void addField(std::string key, double value);
-        void addField(std::string key, bool value);
+        void addField(const std::string &key, const std::string &value);
+        void addField(const std::string &key, std::size_t value);
+        void addField(const std::string &key, double value);
+        void addField(const std::string &key, bool value);
         void endDataPoint(std::size_t timestamp);
 
+        /**
+         * @return "<measurement>,<tagKey>=<tagValue> " escaped, meant to be created once per series
+         */
+        std::string createSeriesKey(const std::string &tagKey, const std::string &tagValue);
+        /**
+         * @return "<fieldKey>=" escaped
+         */
+        std::string createFieldKey(const std::string &fieldKey);
+        /**
+         * fast path for single field data points, only the value and timestamp are formatted
+         * @param seriesKey series key directly followed by the field key
+         */
+        void addDataPoint(std::string_view seriesKey, double value, std::size_t timestamp);
+        /**
+         * fast path for data points with one field per value, non finite values are left out
+         * @param fieldKeys field keys as returned by createFieldKey
+         */
+        void addDataPoint(std::string_view seriesKey, std::span<const std::string *> fieldKeys, std::span<const double> values, std::size_t timestamp);
+
         void flush();
+
+        std::size_t getDroppedBuffers();
+        std::size_t getDroppedPoints();
+        std::size_t getSpooledBytes();
     private:
+        //upper bounds of std::to_chars output
+        static constexpr std::size_t MAX_DOUBLE_CHARS = 24;
+        static constexpr std::size_t MAX_INT_CHARS = 20;
+
         const std::size_t buffer_size = 1024;
         const std::size_t buffer_amount = 2;
-        char **buffer = nullptr;
+        const OverflowPolicy overflow_policy;
+        //every buffer of the pool, owned by the writer
+        std::vector<char *> buffers;
+        //buffer the producer currently formats into
+        char *buffer = nullptr;
         influxDbContext cntxt;
-        uint8_t buffer_sel = 0;
         std::size_t buffer_pos = 0;
         std::size_t last_measurement = 0;
+        //set if the data point under construction doesn't fit into a buffer
+        bool point_overflow = false;
+        std::atomic_size_t dropped_points = 0;
         std::string host, portStr, db, measurement;
-        void pushBuffer();
-        std::vector<std::thread> threads;
-        void joinThreads();
+
+        //guards free_buffers and send_queue, never held while formatting or sending
+        std::mutex queue_mtx;
+        std::condition_variable queue_cv;
+        std::condition_variable free_cv;
+        std::vector<char *> free_buffers;
+        std::deque<std::pair<char *, std::size_t>> send_queue;
+        std::atomic_size_t dropped_buffers = 0;
+
+        //only used by the writer thread
+        const int gzip_level;
+        z_stream_s *zstream = nullptr;
+        std::vector<char> compress_buffer;
+        const std::string spool_directory;
+        const std::size_t spool_max_size;
+        const std::size_t spool_replay_rate;
+        std::unique_ptr<InfluxDbSpool> spool;
+        std::atomic_size_t spooled_bytes = 0;
+        double replay_budget = 0;
+        std::chrono::steady_clock::time_point last_replay;
+        std::chrono::steady_clock::time_point last_connect_attempt;
+
+        std::thread writer_thread;
+        std::atomic_bool running = false;
+        bool connected = false;
+
+        static constexpr std::chrono::milliseconds RECONNECT_INTERVAL{1000};
+        static constexpr std::chrono::milliseconds REPLAY_INTERVAL{100};
+
+        enum class TransmitResult {
+            SENT,
+            //connection broke or the server failed (5xx), worth retrying
+            FAILED,
+            //the server refused the data (4xx), retrying won't help
+            REJECTED
+        };
+
+        bool reserve(std::size_t length);
+        void append(std::string_view str);
         void push();
-        void transferPartialWrite();
+        void transferPartialWrite(char *next);
+        void writerLoop();
+        void sendBuffer(char *data, std::size_t length);
+        TransmitResult transmit(const char *data, std::size_t length);
+        void replaySpool();
+        bool compress(const char *data, std::size_t length, std::size_t &compressed_length);
+        bool connect();
 };
 
-#endif
\ No newline at end of file
+#endif
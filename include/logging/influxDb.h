@@ -31,9 +31,18 @@ extern "C" {
     void set_credentials(influxDbContext *cntxt, const char *username, const char *password);
 
     int initDbContext(influxDbContext *cntxt, const char *hostname, const char *port, const char *database);
+    int reconnectDbContext(influxDbContext *cntxt);
     int deInitDbContext(influxDbContext *cntxt);
 
+    /**
+     * posts the line protocol data on the kept alive connection of the context
+     * returns the http status code of the response or -1 if the connection broke
+     */
     int sendData(influxDbContext *cntxt, char *data, size_t length);
+    /**
+     * same as sendData for data that is already encoded, e.g. content_encoding "gzip"
+     */
+    int sendDataEncoded(influxDbContext *cntxt, char *data, size_t length, const char *content_encoding);
 #ifdef __cplusplus
 }
 #endif
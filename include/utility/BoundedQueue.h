@@ -0,0 +1,139 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#ifndef LLSERVER_ECUI_HOUBOLT_BOUNDEDQUEUE_H
+#define LLSERVER_ECUI_HOUBOLT_BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+#include "common.h"
+
+/**
+ * bounded lock free queue for any number of producers and consumers, every slot carries a sequence number
+ * that tells whether it is free for the producer of a position or filled for its consumer, so producers
+ * only contend on the enqueue position and never wait for each other
+ */
+template <typename T>
+class BoundedQueue
+{
+private:
+    typedef struct
+    {
+        std::atomic_uint64_t sequence;
+        T data;
+    } Slot_t;
+
+    std::unique_ptr<Slot_t[]> slots;
+    uint64_t capacity;
+    uint64_t mask;
+
+    alignas(64) std::atomic_uint64_t enqueuePos = 0;
+    alignas(64) std::atomic_uint64_t dequeuePos = 0;
+
+public:
+    /**
+     * @param capacity number of elements, rounded up to the next power of two
+     */
+    explicit BoundedQueue(uint64_t capacity)
+    {
+        if (capacity == 0)
+        {
+            throw std::runtime_error("BoundedQueue: capacity must be greater than 0");
+        }
+        this->capacity = 1;
+        while (this->capacity < capacity)
+        {
+            this->capacity <<= 1;
+        }
+        mask = this->capacity - 1;
+        slots = std::make_unique<Slot_t[]>(this->capacity);
+        for (uint64_t i = 0; i < this->capacity; i++)
+        {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    /**
+     * @return false if the queue is full
+     */
+    bool TryPush(const T &element)
+    {
+        uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot_t &slot = slots[pos & mask];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t) sequence - (int64_t) pos;
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.data = element;
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                //slot of the previous lap not consumed yet
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @return false if the queue is empty
+     */
+    bool TryPop(T &element)
+    {
+        uint64_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot_t &slot = slots[pos & mask];
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t) sequence - (int64_t) (pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    element = slot.data;
+                    slot.sequence.store(pos + capacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    uint64_t GetCapacity() const
+    { return capacity; };
+
+    /**
+     * @return approximate number of queued elements
+     */
+    uint64_t GetSize() const
+    {
+        uint64_t dequeued = dequeuePos.load(std::memory_order_relaxed);
+        uint64_t enqueued = enqueuePos.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+};
+
+#endif //LLSERVER_ECUI_HOUBOLT_BOUNDEDQUEUE_H
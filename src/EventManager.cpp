@@ -2,7 +2,9 @@
 // Created by Markus on 05.04.21.
 //
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <regex>
 
 #include "EventManager.h"
@@ -33,6 +35,10 @@ void EventManager::Init(Config &config)
 
             mapping = new JSONMapping(config.getMappingFilePath(), "EventMapping");
             mappingJSON = *mapping->GetJSONMapping();
+            for (auto &item : mappingJSON.items())
+            {
+                CompileEvents(item.key(), item.value(), item.key(), "", triggerMap[item.key()]);
+            }
             Debug::print("EventMapping initialized");
             initialized = true;
         }
@@ -80,6 +86,272 @@ bool EventManager::CheckEvents()
     return true;
 }
 
+void EventManager::CompileEvents(const std::string &stateName, const nlohmann::json &events, const std::string &commandKey,
+                                 const std::string &commandChannelName, std::vector<EventTrigger_t> &triggers)
+{
+    for (const nlohmann::json &eventJSON : events)
+    {
+        try
+        {
+            EventTrigger_t trigger{};
+            trigger.comparator = TriggerComparator::ALWAYS;
+            if (eventJSON.contains("triggerType"))
+            {
+                std::string triggerType = eventJSON["triggerType"];
+                trigger.threshold = eventJSON["triggerValue"];
+                if (triggerType == "==")
+                {
+                    trigger.comparator = TriggerComparator::EQUAL;
+                }
+                else if (triggerType == "!=")
+                {
+                    trigger.comparator = TriggerComparator::NOT_EQUAL;
+                }
+                else if (triggerType == ">=")
+                {
+                    trigger.comparator = TriggerComparator::GREATER_EQUAL;
+                }
+                else if (triggerType == "<=")
+                {
+                    trigger.comparator = TriggerComparator::LESS_EQUAL;
+                }
+                else if (triggerType == ">")
+                {
+                    trigger.comparator = TriggerComparator::GREATER;
+                }
+                else if (triggerType == "<")
+                {
+                    trigger.comparator = TriggerComparator::LESS;
+                }
+                else
+                {
+                    Debug::warning("EventManager - CompileEvents: %s: unknown trigger type %s, always triggering...", stateName.c_str(), triggerType.c_str());
+                }
+            }
+
+            bool isState = utils::keyExists(eventJSON, "state");
+            bool isCommand = utils::keyExists(eventJSON, "command");
+            if (isState && isCommand)
+            {
+                throw std::invalid_argument("can't have both command and state key in event definiton");
+            }
+            else if (isState)
+            {
+                if (!utils::keyExists(eventJSON, "value"))
+                {
+                    throw std::invalid_argument("need value key when specifying state in event definiton");
+                }
+                trigger.isCommand = false;
+                trigger.targetState = eventJSON["state"];
+                trigger.targetStateID = INVALID_STATE_ID;
+                trigger.value = CompileArgument(eventJSON["value"], stateName);
+            }
+            else if (isCommand)
+            {
+                trigger.isCommand = true;
+                trigger.commandName = eventJSON["command"];
+                if (!commandChannelName.empty())
+                {
+                    utils::replaceRef(trigger.commandName, commandKey, commandChannelName);
+                }
+                trigger.command = nullptr;
+                if (eventJSON.contains("parameters"))
+                {
+                    for (const nlohmann::json &param : eventJSON["parameters"])
+                    {
+                        trigger.arguments.push_back(CompileArgument(param, commandKey));
+                    }
+                }
+                trigger.argumentValues.resize(trigger.arguments.size());
+            }
+            else
+            {
+                throw std::invalid_argument("need either command or state key in event definiton");
+            }
+            triggers.push_back(std::move(trigger));
+        }
+        catch (const std::exception& e)
+        {
+            Debug::error("EventManager - CompileEvents: %s: %s, ignoring event...", stateName.c_str(), e.what());
+        }
+    }
+}
+
+EventArgument_t EventManager::CompileArgument(const nlohmann::json &param, const std::string &key)
+{
+    EventArgument_t argument{};
+    argument.stateID = INVALID_STATE_ID;
+    if (param.is_string())
+    {
+        if (key == param)
+        {
+            argument.source = EventArgumentSource::TRIGGER_VALUE;
+        }
+        else
+        {
+            argument.source = EventArgumentSource::STATE;
+            argument.stateName = param;
+        }
+    }
+    else if (param.is_number())
+    {
+        argument.source = EventArgumentSource::CONSTANT;
+        argument.value = param;
+    }
+    else
+    {
+        throw std::invalid_argument("parameter not string or number");
+    }
+    return argument;
+}
+
+bool EventManager::CompileDefaultEvents(const std::string &stateName, std::vector<EventTrigger_t> &triggers)
+{
+    std::string commandChannelName = stateName;
+    utils::replaceRef(commandChannelName, "gui:", "");
+    utils::replaceRef(commandChannelName, ":sensor", "");
+    auto channelTypeIt = channelTypeMap.find(commandChannelName);
+    if (channelTypeIt == channelTypeMap.end() || !defaultMappingJSON.contains(channelTypeIt->second))
+    {
+        return false;
+    }
+    Debug::info("Found default event for: %s", stateName.c_str());
+    CompileEvents(stateName, defaultMappingJSON[channelTypeIt->second], channelTypeIt->second, commandChannelName, triggers);
+    return true;
+}
+
+/**
+ * NOTE: triggerMtx must be held
+ * resolves the events of a state on its first change, afterwards it is a direct lookup by state id
+ */
+std::vector<EventTrigger_t> *EventManager::GetTriggers(state_id_t stateID)
+{
+    if (stateID >= stateTriggers.size())
+    {
+        stateTriggers.resize(stateID + 1, nullptr);
+        stateTriggersResolved.resize(stateID + 1, false);
+    }
+    if (!stateTriggersResolved[stateID])
+    {
+        const std::string &stateName = StateController::Instance()->GetStateName(stateID);
+        auto it = triggerMap.find(stateName);
+        if (it != triggerMap.end())
+        {
+            stateTriggers[stateID] = &it->second;
+        }
+        else if (stateName.find("gui:") != std::string::npos)
+        {
+            defaultTriggers.emplace_back();
+            if (CompileDefaultEvents(stateName, defaultTriggers.back()))
+            {
+                stateTriggers[stateID] = &defaultTriggers.back();
+            }
+            else
+            {
+                defaultTriggers.pop_back();
+            }
+        }
+        stateTriggersResolved[stateID] = true;
+    }
+    return stateTriggers[stateID];
+}
+
+/**
+ * triggers only if the new value is in the trigger range and the old one was not
+ */
+bool EventManager::ShallTrigger(const EventTrigger_t &trigger, double oldValue, double newValue)
+{
+    switch (trigger.comparator)
+    {
+        case TriggerComparator::EQUAL:
+            return newValue == trigger.threshold && oldValue != trigger.threshold;
+        case TriggerComparator::NOT_EQUAL:
+            return newValue != trigger.threshold && (oldValue == trigger.threshold || std::isnan(oldValue));
+        case TriggerComparator::GREATER_EQUAL:
+            return newValue >= trigger.threshold && !(oldValue >= trigger.threshold);
+        case TriggerComparator::LESS_EQUAL:
+            return newValue <= trigger.threshold && !(oldValue <= trigger.threshold);
+        case TriggerComparator::GREATER:
+            return newValue > trigger.threshold && !(oldValue > trigger.threshold);
+        case TriggerComparator::LESS:
+            return newValue < trigger.threshold && !(oldValue < trigger.threshold);
+        default:
+            return true;
+    }
+}
+
+double EventManager::GetArgument(EventArgument_t &argument, double newValue)
+{
+    switch (argument.source)
+    {
+        case EventArgumentSource::TRIGGER_VALUE:
+            return newValue;
+        case EventArgumentSource::STATE:
+        {
+            StateController *controller = StateController::Instance();
+            if (argument.stateID == INVALID_STATE_ID)
+            {
+                argument.stateID = controller->RegisterState(argument.stateName);
+            }
+            return controller->GetStateValue(argument.stateID);
+        }
+        default:
+            return argument.value;
+    }
+}
+
+/**
+ * NOTE: triggerMtx must be held
+ */
+void EventManager::ExecuteTriggers(std::vector<EventTrigger_t> &triggers, double oldValue, double newValue, bool testOnly)
+{
+    StateController *controller = StateController::Instance();
+    for (EventTrigger_t &trigger : triggers)
+    {
+        if (!ShallTrigger(trigger, oldValue, newValue))
+        {
+            continue;
+        }
+
+        if (trigger.isCommand)
+        {
+            //the command may have resized the list
+            trigger.argumentValues.resize(trigger.arguments.size());
+            for (size_t i = 0; i < trigger.arguments.size(); i++)
+            {
+                trigger.argumentValues[i] = GetArgument(trigger.arguments[i], newValue);
+            }
+
+            if (trigger.command == nullptr)
+            {
+                auto it = commandMap.find(trigger.commandName);
+                if (it == commandMap.end())
+                {
+                    //state name not in mapping, shall not trigger anything
+                    Debug::error("EventManager - ExecuteTriggers: " + trigger.commandName + " not implemented, ignoring...");
+                    continue;
+                }
+                trigger.command = &it->second;
+            }
+            std::get<0>(*trigger.command)(trigger.argumentValues, testOnly);
+        }
+        else
+        {
+            double newStateVal = GetArgument(trigger.value, newValue);
+            if (trigger.targetStateID == INVALID_STATE_ID)
+            {
+                //registers the state with the same initial value as before
+                controller->SetState(trigger.targetState, newStateVal, utils::getCurrentTimestamp());
+                trigger.targetStateID = controller->GetStateID(trigger.targetState);
+            }
+            else
+            {
+                controller->SetState(trigger.targetStateID, newStateVal, utils::getCurrentTimestamp());
+            }
+        }
+    }
+}
+
 bool EventManager::ShallTrigger(nlohmann::json& event, double& oldValue, double& newValue)
 {
     bool shallTrigger = true;
@@ -219,7 +491,7 @@ double EventManager::GetArgument(const std::string &stateName, nlohmann::json& p
         else
         {
             StateController *controller = StateController::Instance();
-            double val = controller->GetStateValue(param);
+            double val = controller->GetStateValue((std::string) param);
             return val;
         }
     }
@@ -247,7 +519,12 @@ void EventManager::AddChannelTypes(std::map<std::string, std::string>& channelTy
     {
         try
         {
+            std::lock_guard<std::recursive_mutex> lock(triggerMtx);
             channelTypeMap.insert(channelTypes.begin(), channelTypes.end());
+            //default events depend on the channel types, resolve all states again
+            std::fill(stateTriggersResolved.begin(), stateTriggersResolved.end(), false);
+            std::fill(stateTriggers.begin(), stateTriggers.end(), nullptr);
+            defaultTriggers.clear();
         }
         catch (const std::exception& e)
         {
@@ -267,6 +544,7 @@ void EventManager::AddCommands(std::map<std::string, command_t> commands)
     {
         try
         {
+            std::lock_guard<std::recursive_mutex> lock(triggerMtx);
             commandMap.insert(commands.begin(), commands.end());
         }
         catch (const std::exception& e)
@@ -359,116 +637,57 @@ void EventManager::ExecuteRegexCommandOrState(const std::string &regexKey, nlohm
 
 void EventManager::ExecuteCommandOrState(const std::string &stateName, double oldValue, double newValue, bool useDefaultMapping, bool testOnly)
 {
-    nlohmann::json events;
-    std::string currStateName = stateName;
-    std::string commandChannelName = stateName;
+    std::lock_guard<std::recursive_mutex> lock(triggerMtx);
     if (useDefaultMapping)
     {
-        utils::replaceRef(commandChannelName, "gui:", "");
-        utils::replaceRef(commandChannelName, ":sensor", "");
-        currStateName = channelTypeMap[commandChannelName];
-        if (defaultMappingJSON.contains(currStateName))
+        std::vector<EventTrigger_t> triggers;
+        if (CompileDefaultEvents(stateName, triggers))
         {
-            Debug::info("Found default event for: %s", stateName);
+            ExecuteTriggers(triggers, oldValue, newValue, testOnly);
         }
-        events = defaultMappingJSON[currStateName];
     }
     else
     {
-        events = mappingJSON[currStateName];
-    }
-    
-    for (auto& eventJSON : events)
-    {
-        if (!ShallTrigger(eventJSON, oldValue, newValue))
-        {
-            continue;
-        }
-
-        bool isState = utils::keyExists(eventJSON, "state");
-        bool isCommand = utils::keyExists(eventJSON, "command");
-        if (isState && isCommand)
-        {
-            throw std::invalid_argument( "EventManager - ExecuteCommandOrState: can't have both command and state key in event definiton" );
-        }
-        else if (isState)
+        auto it = triggerMap.find(stateName);
+        if (it != triggerMap.end())
         {
-            double newStateVal;
-            if (utils::keyExists(eventJSON, "value"))
-            {
-                newStateVal = GetArgument(stateName, eventJSON["value"], newValue);
-                StateController::Instance()->SetState(eventJSON["state"], newStateVal, utils::getCurrentTimestamp());
-            }
-            else
-            {
-                throw std::invalid_argument( "EventManager - ExecuteCommandOrState: need value key when specifying state in event definiton" );
-            }
-        }
-        else if (isCommand)
-        {
-            std::vector<double> argumentList;
-            GetArgumentList(currStateName, eventJSON, argumentList, newValue);
-
-            std::string commandName = eventJSON["command"];
-            if (useDefaultMapping)
-            {
-                utils::replaceRef(commandName, currStateName, commandChannelName);
-            }
-            //trigger command
-            if (commandMap.find(commandName) == commandMap.end()){
-                //state name not in mapping, shall not trigger anything
-                Debug::error("EventManager - ExecuteCommandOrState: " + commandName + " not implemented, ignoring...");
-                continue;
-            }
-            auto commandFunc = std::get<0>(commandMap[commandName]);
-            commandFunc(argumentList, testOnly);
+            ExecuteTriggers(it->second, oldValue, newValue, testOnly);
         }
-        else
-        {
-            throw std::invalid_argument( "EventManager - ExecuteCommandOrState: need either command or state key in event definiton" );
-        }
-
-
-        
     }
 }
 
 /**
  * when an exception occurs the error is only logged but nothing else happens
+ * states the StateController doesn't know have no events
  * @param stateName
  * @param value
  */
 void EventManager::OnStateChange(const std::string& stateName, double oldValue, double newValue)
+{
+    state_id_t stateID = StateController::Instance()->GetStateID(stateName);
+    if (stateID != INVALID_STATE_ID)
+    {
+        OnStateChange(stateID, oldValue, newValue);
+    }
+}
+
+/**
+ * state change callback of the state controller, evaluates the compiled events of the state
+ * when an exception occurs the error is only logged but nothing else happens
+ * @param stateID
+ * @param oldValue
+ * @param newValue
+ */
+void EventManager::OnStateChange(state_id_t stateID, double oldValue, double newValue)
 {
     try
     {
-        if (!mappingJSON.contains(stateName))
-        {
-            bool foundMatch = false;
-            /* for (auto it = mappingJSON.begin(); it != mappingJSON.end(); ++it)
-            {
-                std::string keyName = it.key();
-                std::regex regex(keyName);
-                if (std::regex_match(stateName, regex))
-                {
-                    ExecuteRegexCommandOrState(it.key(), it.value(), stateName, oldValue, newValue, false);
-                    foundMatch = true;
-                }
-            } */
-            if (!foundMatch && (stateName.find("gui:") != std::string::npos)) {
-                Debug::info("EventManager - OnStateChange: State name not found, looking for default config...");
-                ExecuteCommandOrState(stateName, oldValue, newValue, true, false);
-            }
-            else
-            {
-                //Debug::info("EventManager - OnStateChange: State name not in event mapping...");
-            }    
-        }
-        else
+        std::lock_guard<std::recursive_mutex> lock(triggerMtx);
+        std::vector<EventTrigger_t> *triggers = GetTriggers(stateID);
+        if (triggers != nullptr)
         {
-            ExecuteCommandOrState(stateName, oldValue, newValue, false, false);
+            ExecuteTriggers(*triggers, oldValue, newValue, false);
         }
-        
     }
     catch (const std::exception& e)
     {
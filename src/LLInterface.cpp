@@ -37,7 +37,10 @@ void LLInterface::Init(Config &config)
 
         Debug::print("Initializing StateController...");
         stateController = StateController::Instance();
-        stateController->Init(std::bind(&EventManager::OnStateChange, eventManager, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3), config);
+        stateController->Init([this](state_id_t stateID, double oldValue, double newValue) {
+            eventManager->OnStateChange(stateID, oldValue, newValue);
+        }, config);
+        eventManager->AddCommands({{"PrintStateStats", {std::bind(&StateController::PrintLockStats, stateController, std::placeholders::_1, std::placeholders::_2), {}}}});
         Debug::print("Initializing StateController done\n");
 
         Debug::print("Initializing CANManager...");
@@ -50,9 +53,21 @@ void LLInterface::Init(Config &config)
         LoadGUIStates();
         Debug::print("GUIMapping initialized\n");
 
-        Debug::print("Waiting for States to be initialized...");
-        // stateController->WaitUntilStatesInitialized(); //TODO: uncomment when can interface works
-        Debug::print("All States initialized\n");
+        //only useful if every state gets reported without a request, command responses are only set when a node answers a command
+        nlohmann::json &llServerConfig = config["/LLSERVER"];
+        if (utils::keyExists(llServerConfig, "state_init_timeout"))
+        {
+            Debug::print("Waiting for States to be initialized...");
+            std::chrono::milliseconds stateInitTimeout(llServerConfig["state_init_timeout"].get<int64_t>());
+            if (stateController->WaitUntilStatesInitialized(stateInitTimeout))
+            {
+                Debug::print("All States initialized\n");
+            }
+            else
+            {
+                Debug::print("Continuing with uninitialized States\n");
+            }
+        }
 
         Debug::print("Initializing Thrust Matrix...");
         thrustVariables["alpha"] = config["/THRUST/alpha"];
@@ -97,7 +112,10 @@ LLInterface::~LLInterface()
         Debug::print("Deleting GUI Mapping Manager...");
         delete guiMapping;
 
-        Debug::print("Logged: %zd", StateController::Instance()->count);
+        Debug::print("Logged: %zd", StateController::Instance()->count.load());
+
+        Debug::print("Stopping state events...");
+        stateController->StopEvents();
 
         Debug::print("Shutting down CANManager...");
         CANManager::Destroy();
@@ -199,14 +217,23 @@ void LLInterface::transmitStatesLoop(uint32_t transmitStatesInterval)
 
 	transmitStatesLoopTimer.init();
 
+	//reused every tick, only the changed states are collected
+	std::vector<DirtyState_t> dirtyStates;
+	std::map<std::string, std::tuple<double, uint64_t>> states;
+
 	while(transmitStatesRunning)
 	{
 		transmitStatesLoopTimer.wait();
 
-		std::map<std::string, std::tuple<double, uint64_t>> states = stateController->GetDirtyStates();
+		stateController->GetDirtyStates(dirtyStates);
 
-		if (states.size() > 0)
+		if (dirtyStates.size() > 0)
 		{
+			states.clear();
+			for (DirtyState_t &state : dirtyStates)
+			{
+				states[stateController->GetStateName(state.stateID)] = {state.value, state.timestamp};
+			}
 			uint64_t time_us = transmitStatesLoopTimer.getTimePoint_us();
 			TransmitStates(time_us, states);
 		}
@@ -397,7 +424,7 @@ nlohmann::json LLInterface::GetStates(nlohmann::json &stateNames)
             throw std::runtime_error("LLInterface - GetStates: stateName must be string");
         }
            
-        states[stateName] = stateController->GetState(stateName);
+        states[stateName] = stateController->GetState((std::string) stateName);
     }
     nlohmann::json statesJson = StatesToJson(states);
     return statesJson;
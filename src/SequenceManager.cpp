@@ -7,6 +7,8 @@
 #include "utility/utils.h"
 
 #include "EcuiSocket.h"
+#include "can/CANRecorder.h"
+#include "can/CANTransmitQueue.h"
 
 std::string SequenceManager::configFilePath = "";
 
@@ -144,6 +146,7 @@ void SequenceManager::SetupLogging()
     fileSystem->CreateDirectory("logs");
     fileSystem->CreateDirectory(currentDirPath);
     Debug::changeOutputFile(currentDirPath + "/" + std::string(dateTime_string) + ".csv");
+    CANRecorder::Instance()->Rotate(currentDirPath);
 
     //save Sequence files
     fileSystem->SaveFile(currentDirPath + "/Sequence.json", jsonSequence.dump(4));
@@ -597,6 +600,9 @@ void SequenceManager::abortSequence()
     {
     	isAbortRunning = true;
 
+        // abort commands are sent before anything still queued for the buses
+        CANTransmitQueue::PriorityScope urgent(TxPriority::URGENT);
+
         syncMtx.lock();
 
         for (auto it = jsonAbortSequence["actions"].begin(); it != jsonAbortSequence["actions"].end(); ++it)
@@ -4,8 +4,15 @@
 
 #include "StateController.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "utility/utils.h"
+
 StateController::~StateController()
 {
+    StopEvents();
     initialized = false;
 
     if (logger != nullptr) {
@@ -13,7 +20,7 @@ StateController::~StateController()
     }
 }
 
-void StateController::Init(std::function<void(std::string, double, double)> onStateChangeCallback, Config &config)
+void StateController::Init(std::function<void(state_id_t, double, double)> onStateChangeCallback, Config &config)
 {
     if (!initialized)
     {
@@ -24,47 +31,253 @@ void StateController::Init(std::function<void(std::string, double, double)> onSt
                      config["/INFLUXDB/database_port"],
                      config["/INFLUXDB/database_name"],
                      config["/INFLUXDB/state_measurement"], MICROSECONDS,
-                     config["/INFLUXDB/buffer_size"]);
+                     config["/INFLUXDB/buffer_size"],
+                     InfluxDbLogger::ReadOptions(config["/INFLUXDB"]));
 #endif
+        uint64_t eventQueueSize = DEFAULT_EVENT_QUEUE_SIZE;
+        nlohmann::json &llServerConfig = config["/LLSERVER"];
+        if (utils::keyExists(llServerConfig, "state_event_queue_size"))
+        {
+            eventQueueSize = llServerConfig["state_event_queue_size"].get<uint64_t>();
+        }
+        changeQueue = std::make_unique<BoundedQueue<StateChange_t>>(eventQueueSize);
+        eventsRunning = true;
+        eventThread = new std::thread(&StateController::eventLoop, this);
+        eventThreadID = eventThread->get_id();
         initialized = true;
     }
 }
 
-void StateController::WaitUntilStatesInitialized()
+bool StateController::WaitUntilStatesInitialized(std::chrono::milliseconds timeout, std::chrono::milliseconds progressInterval)
 {
-    bool done = false;
-    bool aborted = false;
-    while (!done)
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::unique_lock<std::mutex> lock(initMtx);
+    while (uninitializedCount.load(std::memory_order_acquire) > 0)
     {
-        stateMtx.lock();
-        for (auto& state : states)
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline)
         {
-            if (std::get<1>(state.second) == 0)
-            {
-                aborted = true;
-                break;
-            }
+            break;
         }
-        stateMtx.unlock();
-        if (aborted)
+        if (initCV.wait_until(lock, std::min(deadline, now + progressInterval), [this] {
+            return uninitializedCount.load(std::memory_order_acquire) <= 0;
+        }))
         {
-            aborted = false;
+            break;
         }
-        else
+        if (std::chrono::steady_clock::now() < deadline)
         {
-            done = true;
+            Debug::print("StateController - WaitUntilStatesInitialized: %ld of %u states uninitialized",
+                         uninitializedCount.load(std::memory_order_relaxed), stateCount.load(std::memory_order_relaxed));
         }
     }
+    lock.unlock();
 
+    if (uninitializedCount.load(std::memory_order_acquire) <= 0)
+    {
+        return true;
+    }
+
+    std::vector<std::string> missingStates = GetUninitializedStates();
+    std::string missingNames;
+    for (std::string &stateName : missingStates)
+    {
+        missingNames += (missingNames.empty() ? "" : ", ") + stateName;
+    }
+    Debug::error("StateController - WaitUntilStatesInitialized: %zu states uninitialized after %ld ms: %s",
+                 missingStates.size(), (long) timeout.count(), missingNames.c_str());
+    return false;
 }
 
-void StateController::AddUninitializedStates(std::vector<std::string> &states)
+std::vector<std::string> StateController::GetUninitializedStates()
 {
-    std::lock_guard<std::mutex> lock(stateMtx);
+    std::vector<StateEntry_t> entries;
+    Snapshot(entries);
+
+    std::shared_lock<std::shared_mutex> lock(registryMtx);
+    std::vector<std::string> missingStates;
+    for (state_id_t stateID = 0; stateID < entries.size(); stateID++)
+    {
+        if (entries[stateID].timestamp == 0)
+        {
+            missingStates.push_back(stateNames[stateID]);
+        }
+    }
+    return missingStates;
+}
+
+void StateController::UpdateInitialized(uint64_t oldTimestamp, uint64_t newTimestamp)
+{
+    if (oldTimestamp == 0 && newTimestamp != 0)
+    {
+        if (uninitializedCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            //the waiter checks the count under initMtx, so it can't miss this
+            {
+                std::lock_guard<std::mutex> lock(initMtx);
+            }
+            initCV.notify_all();
+        }
+    }
+    else if (oldTimestamp != 0 && newTimestamp == 0)
+    {
+        uninitializedCount.fetch_add(1, std::memory_order_acq_rel);
+    }
+}
+
+std::unique_lock<std::mutex> StateController::LockShard(Shard_t &shard)
+{
+    std::unique_lock<std::mutex> lock(shard.mtx, std::try_to_lock);
+    shard.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    if (!lock.owns_lock())
+    {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        uint64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        shard.contentions.fetch_add(1, std::memory_order_relaxed);
+        shard.waitTime.fetch_add(waited, std::memory_order_relaxed);
+    }
+    return lock;
+}
+
+std::array<std::unique_lock<std::mutex>, StateController::SHARD_COUNT> StateController::LockAllShards()
+{
+    std::array<std::unique_lock<std::mutex>, SHARD_COUNT> locks;
+    for (state_id_t i = 0; i < SHARD_COUNT; i++)
+    {
+        locks[i] = LockShard(shards[i]);
+    }
+    return locks;
+}
+
+void StateController::CountBulkRead(uint64_t holdTime)
+{
+    snapshots.fetch_add(1, std::memory_order_relaxed);
+    snapshotHoldTime.fetch_add(holdTime, std::memory_order_relaxed);
+    uint64_t maxHoldTime = snapshotMaxHoldTime.load(std::memory_order_relaxed);
+    while (holdTime > maxHoldTime && !snapshotMaxHoldTime.compare_exchange_weak(maxHoldTime, holdTime, std::memory_order_relaxed));
+}
+
+void StateController::Snapshot(std::vector<StateEntry_t> &entries)
+{
+    //states registered during the copy are not part of it
+    state_id_t stateCount = this->stateCount.load(std::memory_order_acquire);
+    entries.resize(stateCount);
+
+    auto locks = LockAllShards();
+    auto start = std::chrono::steady_clock::now();
+
+    for (state_id_t stateID = 0; stateID < stateCount; stateID++)
+    {
+        entries[stateID] = GetEntry(GetShard(stateID), stateID);
+    }
+
+    uint64_t held = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    for (auto &lock : locks)
+    {
+        lock.unlock();
+    }
+    CountBulkRead(held);
+}
+
+/**
+ * NOTE: registryMtx must be held exclusively by the caller
+ * @param stateName
+ * @param isNew true if the state was not registered before
+ * @param initialValue value of a new state
+ * @return handle of the state
+ */
+state_id_t StateController::RegisterStateUnlocked(const std::string &stateName, bool &isNew, double initialValue)
+{
+    auto it = stateIDMap.find(stateName);
+    if (it != stateIDMap.end())
+    {
+        isNew = false;
+        return it->second;
+    }
+
+    isNew = true;
+    state_id_t stateID = (state_id_t) stateNames.size();
+    stateNames.push_back(stateName);
+    stateIDMap[stateName] = stateID;
+    {
+        Shard_t &shard = GetShard(stateID);
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+        shard.entries.push_back({initialValue, 0, false});
+        shard.names.push_back(&stateNames.back());
+        uninitializedCount.fetch_add(1, std::memory_order_acq_rel);
+    }
+    stateCount.store(stateID + 1, std::memory_order_release);
+    return stateID;
+}
+
+/**
+ * looks the state up with the shared lock and only registers it exclusively if it is new
+ */
+state_id_t StateController::RegisterState(const std::string &stateName, bool &isNew, double initialValue)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(registryMtx);
+        auto it = stateIDMap.find(stateName);
+        if (it != stateIDMap.end())
+        {
+            isNew = false;
+            return it->second;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(registryMtx);
+    return RegisterStateUnlocked(stateName, isNew, initialValue);
+}
+
+state_id_t StateController::RegisterState(const std::string &stateName)
+{
+    bool isNew;
+    return RegisterState(stateName, isNew);
+}
+
+void StateController::CheckStateID(state_id_t stateID, const char *caller)
+{
+    if (stateID >= stateCount.load(std::memory_order_acquire))
+    {
+        throw std::runtime_error("StateController - " + std::string(caller) + ": state id " + std::to_string(stateID) + " not registered");
+    }
+}
+
+state_id_t StateController::GetStateID(const std::string &stateName)
+{
+    std::shared_lock<std::shared_mutex> lock(registryMtx);
+    auto it = stateIDMap.find(stateName);
+    if (it == stateIDMap.end())
+    {
+        return INVALID_STATE_ID;
+    }
+    return it->second;
+}
+
+const std::string &StateController::GetStateName(state_id_t stateID)
+{
+    CheckStateID(stateID, "GetStateName");
+    std::shared_lock<std::shared_mutex> lock(registryMtx);
+    return stateNames[stateID];
+}
+
+std::vector<state_id_t> StateController::AddUninitializedStates(std::vector<std::string> &states)
+{
+    std::unique_lock<std::shared_mutex> registryLock(registryMtx);
+    std::vector<state_id_t> stateIDs;
+    stateIDs.reserve(states.size());
+    bool isNew;
     for (std::string &state : states)
     {
-        this->states[state] = {0.0, 0, false};
+        state_id_t stateID = RegisterStateUnlocked(state, isNew);
+        Shard_t &shard = GetShard(stateID);
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+        StateEntry_t &entry = GetEntry(shard, stateID);
+        UpdateInitialized(entry.timestamp, 0);
+        entry = {0.0, 0, false};
+        stateIDs.push_back(stateID);
     }
+    return stateIDs;
 }
 
 /**
@@ -73,63 +286,80 @@ void StateController::AddUninitializedStates(std::vector<std::string> &states)
  */
 void StateController::AddStates(std::map<std::string, std::tuple<double, uint64_t>> &states)
 {
-    std::lock_guard<std::mutex> lock(stateMtx);
+    std::unique_lock<std::shared_mutex> registryLock(registryMtx);
+    bool isNew;
     for (auto& state : states)
     {
-        this->states[state.first] = {std::get<0>(state.second), std::get<1>(state.second), false};
+        state_id_t stateID = RegisterStateUnlocked(state.first, isNew);
+        Shard_t &shard = GetShard(stateID);
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+        StateEntry_t &entry = GetEntry(shard, stateID);
+        UpdateInitialized(entry.timestamp, std::get<1>(state.second));
+        entry = {std::get<0>(state.second), std::get<1>(state.second), false};
     }
 }
 
 std::tuple<double, uint64_t, bool> StateController::GetState(std::string stateName)
 {
-    std::lock_guard<std::mutex> lock(stateMtx);
-    std::tuple<double, uint64_t, bool> value;
-    try
-    {
-        value = states.at(stateName);
-    }
-    catch (const std::exception& e)
+    state_id_t stateID = GetStateID(stateName);
+    if (stateID == INVALID_STATE_ID)
     {
-        throw std::runtime_error("StateController - GetState: " + std::string(e.what()));
+        throw std::runtime_error("StateController - GetState: state " + stateName + " not found");
     }
-    return value;
+    return GetState(stateID);
+}
+
+std::tuple<double, uint64_t, bool> StateController::GetState(state_id_t stateID)
+{
+    CheckStateID(stateID, "GetState");
+    Shard_t &shard = GetShard(stateID);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    StateEntry_t &state = GetEntry(shard, stateID);
+    return {state.value, state.timestamp, state.dirty};
 }
 
+/**
+ * registers the state if it doesn't exist yet, prefer the state id overload on hot paths
+ */
 void StateController::SetState(std::string stateName, double value, uint64_t timestamp)
+{
+    bool isNew;
+    //states which are not known beforehand report NAN as old value
+    state_id_t stateID = RegisterState(stateName, isNew, NAN);
+    SetState(stateID, value, timestamp);
+}
+
+void StateController::SetState(state_id_t stateID, double value, uint64_t timestamp)
 {
     try
     {
+        CheckStateID(stateID, "SetState");
         double oldValue;
-        bool firstEntry = false;
         {
-            std::lock_guard<std::mutex> lock(stateMtx);
-            
-            if (this->states.find(stateName) == this->states.end())
-            {
-                firstEntry = true;
-            }
-            auto *state = &this->states[stateName]; //this inits tuple to 0s when statename not in states
-            if (firstEntry)
+            Shard_t &shard = GetShard(stateID);
+            std::unique_lock<std::mutex> lock = LockShard(shard);
+
+            StateEntry_t &state = GetEntry(shard, stateID);
+            oldValue = state.value;
+            UpdateInitialized(state.timestamp, timestamp);
+
+            state.value = value;
+            state.timestamp = timestamp;
+            if (!state.dirty)
             {
-                oldValue = NAN;
+                shard.dirtyIDs.push_back(stateID);
+                state.dirty = true;
             }
-            else
+            //Debug::print("%zd: %s, %zd", count, stateNames[stateID].c_str(), count);
+            //changes caused by events still dispatched while stopping are queued as well
+            if (eventsRunning.load(std::memory_order_relaxed) || std::this_thread::get_id() == eventThreadID.load(std::memory_order_relaxed))
             {
-                oldValue = std::get<0>(*state);
-            }
-            
-            std::get<0>(*state) = value;
-            std::get<1>(*state) = timestamp;
-            std::get<2>(*state) = true;
-            //Debug::print("%zd: %s, %zd", count, stateName.c_str(), count);
-#ifndef NO_INFLUX
-            logger->log(stateName, value, timestamp);
-#endif
-            if(timestamp != 0) {
-                count++;
+                QueueChange(shard, {shard.names[stateID / SHARD_COUNT], stateID, oldValue, value, timestamp}, lock);
             }
         }
-        this->onStateChangeCallback(stateName, oldValue, value);
+        if(timestamp != 0) {
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
     }
     catch (const std::exception& e)
     {
@@ -137,32 +367,182 @@ void StateController::SetState(std::string stateName, double value, uint64_t tim
     }
 }
 
-double StateController::GetStateValue(std::string stateName)
+/**
+ * queued while the shard lock is held, so changes of a state keep their order
+ * a change that doesn't fit into the queue is appended to the pending changes of its shard, and as long as there
+ * are any, every later change of the shard is appended behind them, the event thread moves them into the queue
+ * setters wait for their change to be moved without holding the shard lock, the event thread never waits
+ */
+void StateController::QueueChange(Shard_t &shard, const StateChange_t &change, std::unique_lock<std::mutex> &shardLock)
+{
+    if (shard.pendingChanges.empty() && changeQueue->TryPush(change))
+    {
+        SignalChange();
+        return;
+    }
+
+    queueFullCount.fetch_add(1, std::memory_order_relaxed);
+    uint64_t ticket = shard.pendingAppended++;
+    shard.pendingChanges.push_back(change);
+    pendingChangeCount.fetch_add(1, std::memory_order_seq_cst);
+    SignalChange();
+    if (std::this_thread::get_id() == eventThreadID.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    //the event thread might need this shard to process the queue
+    shardLock.unlock();
+    while (shard.pendingMoved.load(std::memory_order_acquire) <= ticket && eventsRunning.load(std::memory_order_relaxed))
+    {
+        std::this_thread::yield();
+    }
+}
+
+void StateController::SignalChange()
+{
+    changeSignal.fetch_add(1, std::memory_order_seq_cst);
+    if (eventThreadWaiting.load(std::memory_order_seq_cst))
+    {
+        changeSignal.notify_one();
+    }
+}
+
+void StateController::MovePendingChanges()
+{
+    if (pendingChangeCount.load(std::memory_order_acquire) == 0)
+    {
+        return;
+    }
+    for (Shard_t &shard : shards)
+    {
+        std::unique_lock<std::mutex> lock = LockShard(shard);
+        while (!shard.pendingChanges.empty() && changeQueue->TryPush(shard.pendingChanges.front()))
+        {
+            shard.pendingChanges.pop_front();
+            pendingChangeCount.fetch_sub(1, std::memory_order_relaxed);
+            shard.pendingMoved.fetch_add(1, std::memory_order_release);
+        }
+    }
+}
+
+void StateController::DispatchChange(const StateChange_t &change)
 {
-    std::lock_guard<std::mutex> lock(stateMtx);
-    double value;
     try
     {
-        value = std::get<0>(states[stateName]);
+#ifndef NO_INFLUX
+        logger->log(*change.stateName, change.newValue, change.timestamp);
+#endif
+        this->onStateChangeCallback(change.stateID, change.oldValue, change.newValue);
     }
     catch (const std::exception& e)
     {
-        throw std::runtime_error("StateController - GetStateValue: " + std::string(e.what()));
+        Debug::error("StateController - DispatchChange: %s: %s", change.stateName->c_str(), e.what());
     }
-    return value;
+    dispatchedChanges.fetch_add(1, std::memory_order_relaxed);
 }
 
-std::map<std::string, std::tuple<double, uint64_t>> StateController::GetDirtyStates()
+void StateController::eventLoop()
 {
-    std::lock_guard<std::mutex> lock(stateMtx);
-    std::map<std::string, std::tuple<double, uint64_t>> dirties;
-    for (auto& state : this->states)
+    StateChange_t change;
+    while (true)
+    {
+        uint32_t signal = changeSignal.load(std::memory_order_acquire);
+        //pending changes go behind everything queued before them, including the changes of the current dispatch
+        MovePendingChanges();
+        if (changeQueue->TryPop(change))
+        {
+            DispatchChange(change);
+            continue;
+        }
+        if (pendingChangeCount.load(std::memory_order_acquire) > 0)
+        {
+            continue;
+        }
+        if (!eventsRunning.load(std::memory_order_acquire))
+        {
+            //queue is drained
+            break;
+        }
+        eventThreadWaiting.store(true, std::memory_order_seq_cst);
+        changeSignal.wait(signal, std::memory_order_acquire);
+        eventThreadWaiting.store(false, std::memory_order_relaxed);
+    }
+}
+
+void StateController::StopEvents()
+{
+    if (eventThread == nullptr)
+    {
+        return;
+    }
+    eventsRunning = false;
+    changeSignal.fetch_add(1, std::memory_order_seq_cst);
+    changeSignal.notify_one();
+    if (eventThread->joinable())
+    {
+        eventThread->join();
+    }
+    delete eventThread;
+    eventThread = nullptr;
+    eventThreadID = std::thread::id();
+}
+
+/**
+ * registers the state if it doesn't exist yet
+ */
+double StateController::GetStateValue(std::string stateName)
+{
+    return GetStateValue(RegisterState(stateName));
+}
+
+double StateController::GetStateValue(state_id_t stateID)
+{
+    CheckStateID(stateID, "GetStateValue");
+    Shard_t &shard = GetShard(stateID);
+    std::unique_lock<std::mutex> lock = LockShard(shard);
+    return GetEntry(shard, stateID).value;
+}
+
+void StateController::GetDirtyStates(std::vector<DirtyState_t> &dirtyStates)
+{
+    dirtyStates.clear();
+
+    auto locks = LockAllShards();
+    auto start = std::chrono::steady_clock::now();
+
+    for (Shard_t &shard : shards)
     {
-        if (std::get<2>(state.second))
+        for (state_id_t stateID : shard.dirtyIDs)
         {
-            dirties[state.first] =  {std::get<0>(state.second), std::get<1>(state.second)};
-            std::get<2>(state.second) = false;
+            //re-added states lose the flag but stay in the list
+            StateEntry_t &state = GetEntry(shard, stateID);
+            if (state.dirty)
+            {
+                dirtyStates.push_back({stateID, state.value, state.timestamp});
+                state.dirty = false;
+            }
         }
+        shard.dirtyIDs.clear();
+    }
+
+    uint64_t held = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    for (auto &lock : locks)
+    {
+        lock.unlock();
+    }
+    CountBulkRead(held);
+}
+
+std::map<std::string, std::tuple<double, uint64_t>> StateController::GetDirtyStates()
+{
+    std::vector<DirtyState_t> dirtyStates;
+    GetDirtyStates(dirtyStates);
+
+    std::shared_lock<std::shared_mutex> lock(registryMtx);
+    std::map<std::string, std::tuple<double, uint64_t>> dirties;
+    for (DirtyState_t &state : dirtyStates)
+    {
+        dirties[stateNames[state.stateID]] = {state.value, state.timestamp};
     }
 
     return dirties;
@@ -170,8 +550,44 @@ std::map<std::string, std::tuple<double, uint64_t>> StateController::GetDirtySta
 
 std::map<std::string, std::tuple<double, uint64_t, bool>> StateController::GetAllStates()
 {
-    std::lock_guard<std::mutex> lock(stateMtx);
+    std::vector<StateEntry_t> entries;
+    Snapshot(entries);
+
+    std::shared_lock<std::shared_mutex> lock(registryMtx);
     std::map<std::string, std::tuple<double, uint64_t, bool>> statesCopy;
-    statesCopy.insert(states.begin(), states.end());
+    for (state_id_t stateID = 0; stateID < entries.size(); stateID++)
+    {
+        StateEntry_t &state = entries[stateID];
+        statesCopy[stateNames[stateID]] = {state.value, state.timestamp, state.dirty};
+    }
     return statesCopy;
 }
+
+void StateController::PrintLockStats(std::vector<double> &params, bool testOnly)
+{
+    if (testOnly)
+    {
+        return;
+    }
+    Debug::print("State shard locks:");
+    state_id_t stateCount = this->stateCount.load(std::memory_order_acquire);
+    for (state_id_t i = 0; i < SHARD_COUNT; i++)
+    {
+        Shard_t &shard = shards[i];
+        state_id_t shardStateCount = (stateCount + SHARD_COUNT - 1 - i) / SHARD_COUNT;
+        uint64_t contentions = shard.contentions.load(std::memory_order_relaxed);
+        uint64_t waitTime = shard.waitTime.load(std::memory_order_relaxed);
+        Debug::print("\tshard %2u: %u states, %lu acquisitions, %lu contended, %lu ns avg wait", i, shardStateCount,
+                     shard.acquisitions.load(std::memory_order_relaxed), contentions, contentions > 0 ? waitTime / contentions : 0);
+    }
+    uint64_t snapshotCount = snapshots.load(std::memory_order_relaxed);
+    Debug::print("\tbulk reads: %lu, %lu ns avg hold time, %lu ns max hold time", snapshotCount,
+                 snapshotCount > 0 ? snapshotHoldTime.load(std::memory_order_relaxed) / snapshotCount : 0,
+                 snapshotMaxHoldTime.load(std::memory_order_relaxed));
+    if (changeQueue)
+    {
+        Debug::print("\tevent queue: %lu of %lu queued, %lu dispatched, %lu times full", changeQueue->GetSize(),
+                     changeQueue->GetCapacity(), dispatchedChanges.load(std::memory_order_relaxed),
+                     queueFullCount.load(std::memory_order_relaxed));
+    }
+}
@@ -3,8 +3,10 @@
 
 
 CANDriver::CANDriver(std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback,
-                     std::function<void(std::string *)> onErrorCallback) :
+                     std::function<void(std::string *)> onErrorCallback,
+                     std::function<void(std::span<CANFrame_t>, CANDriver *driver)> onRecvBatchCallback) :
 	onRecvCallback(std::move(onRecvCallback)),
+	onRecvBatchCallback(std::move(onRecvBatchCallback)),
 	onErrorCallback(std::move(onErrorCallback))
 {
 
@@ -2,13 +2,17 @@
 
 #include "can/CANDriverKvaser.h"
 #include <utility>
+#include <algorithm>
 #include <string>
+#include <chrono>
+#include <pthread.h>
 #include "can_houbolt/can_cmds.h"
 #include "utility/utils.h"
 
 CANDriverKvaser::CANDriverKvaser(std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback,
-								 std::function<void(std::string *)> onErrorCallback, std::vector<uint32_t> &canBusChannelIDs, Config &config) :
-	CANDriver(onRecvCallback, onErrorCallback)
+								 std::function<void(std::string *)> onErrorCallback, std::vector<uint32_t> &canBusChannelIDs, Config &config,
+								 std::function<void(std::span<CANFrame_t>, CANDriver *driver)> onRecvBatchCallback) :
+	CANDriver(onRecvCallback, onErrorCallback, onRecvBatchCallback)
 {
     //arbitration bus parameters
     int32_t bitrate = config["/CAN/BUS/ARBITRATION/bitrate"];
@@ -29,6 +33,21 @@ CANDriverKvaser::CANDriverKvaser(std::function<void(uint8_t &, uint32_t &, uint8
 
     nlohmann::json busExtra = config["/CAN/BUS_EXTRA"];
 
+    nlohmann::json canConfig = config["/CAN"];
+    if (utils::keyExists(canConfig, "receive_queue_size"))
+    {
+        receiveQueueSize = canConfig["receive_queue_size"];
+    }
+    if (utils::keyExists(canConfig, "receive_batch_size"))
+    {
+        receiveBatchSize = canConfig["receive_batch_size"];
+        if (receiveBatchSize == 0) throw std::runtime_error("CAN receive_batch_size must be greater than 0");
+    }
+    if (utils::keyExists(canConfig, "receive_thread_cores"))
+    {
+        receiveThreadCores = (std::vector<int>)canConfig["receive_thread_cores"];
+    }
+
     canStatus stat;
     for (auto &channelID : canBusChannelIDs)
     {
@@ -58,18 +77,59 @@ CANDriverKvaser::CANDriverKvaser(std::function<void(uint8_t &, uint32_t &, uint8
             dataParamsMap[channelID] = dataParams;
         }
 
-        
-        stat = InitializeCANChannel(channelID);
+        // the queue has to exist before the callback is registered
+        Receiver_t *receiver = receivers.emplace_back(std::make_unique<Receiver_t>()).get();
+        receiver->driver = this;
+        receiver->canBusChannelID = channelID;
+        receiver->queue = std::make_unique<CANReceiveQueue>(receiveQueueSize);
+        receiver->droppedFrames = 0;
+
+        stat = InitializeCANChannel(channelID, receiver);
         if (stat < 0) {
             std::ostringstream stringStream;
             stringStream << "CANDriver - Constructor: CAN-Channel " << channelID << ": " << CANError(stat);
             throw std::runtime_error(stringStream.str());
         }
     }
+
+    size_t transmitQueueSize = 1024;
+    size_t transmitBatchSize = 32;
+    if (utils::keyExists(canConfig, "transmit_queue_size"))
+    {
+        transmitQueueSize = canConfig["transmit_queue_size"];
+    }
+    if (utils::keyExists(canConfig, "transmit_batch_size"))
+    {
+        transmitBatchSize = canConfig["transmit_batch_size"];
+    }
+    transmitQueue = new CANTransmitQueue(canBusChannelIDs, std::bind(&CANDriverKvaser::SendBatch, this, std::placeholders::_1, std::placeholders::_2),
+                                         transmitQueueSize, transmitBatchSize);
+
+    // frames received so far wait in the queues until the workers start
+    for (size_t i = 0; i < receivers.size(); i++)
+    {
+        int core = i < receiveThreadCores.size() ? receiveThreadCores[i] : -1;
+        receivers[i]->worker = std::thread(&CANDriverKvaser::receiveLoop, this, receivers[i].get(), core);
+    }
 }
 
 CANDriverKvaser::~CANDriverKvaser()
 {
+    // no callback may write into a receiver after this
+    for (auto &receiver : receivers)
+    {
+        (void) kvSetNotifyCallback(receiver->handle, nullptr, nullptr, 0);
+    }
+    done = true;
+    for (auto &receiver : receivers)
+    {
+        receiver->queue->Notify();
+        if (receiver->worker.joinable()) receiver->worker.join();
+    }
+
+    // sends what is still queued
+    delete transmitQueue;
+
     // Empty transfer queues (not strictly necessary but recommended by Kvaser)
     for (auto &handle : canHandlesMap)
     {
@@ -105,22 +165,34 @@ void CANDriverKvaser::SendCANMessage(uint32_t canChannelID, uint32_t canID, uint
     {
         throw std::runtime_error("CANDriver - SendCANMessage: correct dlc couldn't be found");
     }
-    // Flags mean that the message is a FD message with bit rate switching (FDF, BRS)
     uint8_t msg[64] = {0};
     std::copy_n(payload, payloadLength, msg);
-    
-    canStatus stat;
-    if (blocking)
-    {
-        stat = canWriteWait(canHandlesMap[canChannelID], canID, (void *) msg, dlcBytes, canFDMSG_FDF | canFDMSG_BRS, blockingTimeout);
-    }
-    else
+
+    transmitQueue->Push(canChannelID, canID, msg, dlcBytes, blocking);
+}
+
+/**
+ * writes the frames back to back from the transmit thread of the bus
+ */
+void CANDriverKvaser::SendBatch(uint32_t canBusChannelID, std::span<TxFrame_t> frames)
+{
+    canHandle handle = canHandlesMap.at(canBusChannelID);
+    for (TxFrame_t &frame : frames)
     {
-        stat = canWrite(canHandlesMap[canChannelID], canID, (void *) msg, dlcBytes, canFDMSG_FDF | canFDMSG_BRS);
-    }
-    
-    if(stat < 0) {
-        throw std::runtime_error("CANDriver - SendCANMessage: " + CANError(stat));
+        // Flags mean that the message is a FD message with bit rate switching (FDF, BRS)
+        canStatus stat;
+        if (frame.blocking)
+        {
+            stat = canWriteWait(handle, frame.canID, (void *) frame.payload, frame.payloadLength, canFDMSG_FDF | canFDMSG_BRS, blockingTimeout);
+        }
+        else
+        {
+            stat = canWrite(handle, frame.canID, (void *) frame.payload, frame.payloadLength, canFDMSG_FDF | canFDMSG_BRS);
+        }
+
+        if(stat < 0) {
+            throw std::runtime_error("CANDriver - SendCANMessage: " + CANError(stat));
+        }
     }
 }
 
@@ -144,30 +216,149 @@ std::map<std::string, bool> CANDriverKvaser::GetCANStatusReadable(uint32_t canBu
 }
 
 
-//TODO: MP maybe create 2 callbacks one for until init done and one for afterwards to eliminate bus channel id search
-// if not needed
-void CANDriverKvaser::OnCANCallback(int handle, void *driver, unsigned int event)
+void CANDriverKvaser::receiveLoop(Receiver_t *receiver, int core)
 {
-    CANDriverKvaser *canDriver = (CANDriverKvaser *) driver;
+    if (core >= 0)
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(core, &cpuSet);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0)
+        {
+            Debug::warning("CANDriverKvaser::receiveLoop: couldn't pin receive thread of can bus %u to core %d", receiver->canBusChannelID, core);
+        }
+    }
+
+    CANReceiveQueue *queue = receiver->queue.get();
+    std::vector<CANFrame_t> frames(receiveBatchSize);
+    uint64_t reportedDrops = 0;
+    auto lastDropReport = std::chrono::steady_clock::time_point();
+    while (!done)
+    {
+        uint64_t available = queue->Wait(done);
+        size_t count = std::min<uint64_t>(available, receiveBatchSize);
+        if (count == 0)
+        {
+            continue;
+        }
 
+        // the payloads stay in the queue slots until the batch is processed
+        for (size_t i = 0; i < count; i++)
+        {
+            CANReceiveQueue::Slot_t &slot = queue->Peek(i);
+            frames[i] = {(uint8_t) receiver->canBusChannelID, slot.canID, slot.payload, slot.payloadLength, slot.timestamp};
+        }
+        try
+        {
+            deliverBatch(std::span<CANFrame_t>(frames.data(), count));
+        }
+        catch (const std::exception &e)
+        {
+            Debug::error("CANDriverKvaser::receiveLoop error: %s", e.what());
+        }
+        queue->Release(count);
+
+        uint64_t drops = receiver->droppedFrames.load(std::memory_order_relaxed);
+        if (drops != reportedDrops && std::chrono::steady_clock::now() - lastDropReport > std::chrono::seconds(1))
+        {
+            Debug::error("CANDriverKvaser: receive queue of can bus %u full, %lu frames dropped so far", receiver->canBusChannelID, drops);
+            reportedDrops = drops;
+            lastDropReport = std::chrono::steady_clock::now();
+        }
+    }
+}
+
+/**
+ * runs in the notify thread of canlib, only reads the frames into the receive queue of the bus, the worker
+ * of the bus processes them
+ */
+void CANDriverKvaser::OnCANCallback(int handle, void *context, unsigned int event)
+{
+    Receiver_t *receiver = (Receiver_t *) context;
+    CANDriverKvaser *canDriver = receiver->driver;
+    CANReceiveQueue *queue = receiver->queue.get();
+
+    // As the callback only gets entered when the receive queue was empty, empty it in here, on every event
+    // so frames received together with an error or status change are not lost
     canStatus stat;
     int64_t id;
     uint32_t dlc, flags;
-    uint8_t data[64];
     uint64_t timestamp;
-    
-    // As the callback only gets entered when the receive queue was empty, empty it in here
+    uint8_t discarded[64];
+    uint64_t received = 0;
+    while (true)
+    {
+        CANReceiveQueue::Slot_t *slot = queue->Claim();
+        if (slot == nullptr && received > 0)
+        {
+            // the worker might still be asleep
+            queue->Notify();
+            received = 0;
+        }
+        uint8_t *data = slot != nullptr ? slot->payload : discarded;
+        stat = canRead(handle, &id, data, &dlc, &flags, &timestamp); //TODO: is dlc the length code or the actual length?
+        if (stat != canOK)
+        {
+            break;
+        }
+        if (id < 0)
+        {
+            Debug::error("CANDriver - OnCANCallback: id negative");
+            continue;
+        }
+        //TODO: MP flag is canok but it seems that its actuall canERR_NOMSG, further debugging needed to remove this dlc check
+        if (dlc == 0 || dlc > 64)
+        {
+            uint64_t statFlags = 0;
+            (void) canReadStatus(handle, &statFlags);
+            if (statFlags & canSTAT_SW_OVERRUN)
+            {
+                Debug::error("CANDriver - OnCANCallback: Software Overrun on can bus %d...", receiver->canBusChannelID);
+            }
+            else if (statFlags & canSTAT_HW_OVERRUN)
+            {
+                Debug::error("CANDriver - OnCANCallback: Hardware Overrun on can bus %d...", receiver->canBusChannelID);
+            }
+            else
+            {
+                Debug::error("CANDriver - OnCANCallback: canID: %d, dlc: %d, invalid msg on can bus %d detected, ignoring...", id, dlc, receiver->canBusChannelID);
+            }
+            Debug::print("\t\tCAN Status Flags: 0x%016x", statFlags);
+            continue;
+        }
+        if (slot == nullptr)
+        {
+            receiver->droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
 
-    stat = canRead(handle, &id, data, &dlc, &flags, &timestamp); //TODO: is dlc the length code or the actual length?
+        //TODO: switch timestamp to current unix time
+        slot->timestamp = utils::getCurrentTimestamp();
+        slot->canID = (uint32_t) id;
+        slot->payloadLength = dlc;
+        queue->Publish();
+        // wake the worker during long bursts instead of only once canlib is drained
+        if (++received == canDriver->receiveBatchSize)
+        {
+            queue->Notify();
+            received = 0;
+        }
+    }
+    if (received > 0)
+    {
+        queue->Notify();
+    }
 
     switch(event) {
+        case canNOTIFY_RX:
         case canNOTIFY_ERROR:
         {
-            if(stat != canOK) {
-                std::string errorMsg = "canNOTIFY_ERROR: " + canDriver->CANError(stat);
+            // stat is either canERR_NOMSG or any different error code
+            if(stat != canERR_NOMSG) {
+                std::string errorMsg = (event == canNOTIFY_RX ? "canNOTIFY_RX: " : "canNOTIFY_ERROR: ") + canDriver->CANError(stat);
                 canDriver->onErrorCallback(&errorMsg);
             }
-            break;   
+            break;
         }
         case canNOTIFY_STATUS:
         {
@@ -179,72 +370,8 @@ void CANDriverKvaser::OnCANCallback(int handle, void *driver, unsigned int event
             }
             break;
         }
-        case canNOTIFY_RX:
-        {
-            while (stat == canOK) {
-                if (id < 0)
-                {
-                    Debug::error("CANDriver - OnCANCallback: id negative");
-                    return;
-                }
-                uint8_t canBusChannelID = -1;
-                const auto &handleFindIt = canDriver->canHandlesMap.find(handle);
-                if (handleFindIt != canDriver->canHandlesMap.end())
-                {
-                    canBusChannelID = handleFindIt->first;
-                }
-                else
-                {
-                    Debug::error("CANDriver - OnCANCallback: can handle not found");
-                    return;
-                }
-                //TODO: wrap a try except around
-                //TODO: switch timestamp to current unix time
-                uint64_t softwareTime = utils::getCurrentTimestamp();
-                uint64_t statFlags = 0;
-                //TODO: MP flag is canok but it seems that its actuall canERR_NOMSG, further debugging needed to remove this dlc check
-                if (dlc > 0)
-                {
-                    try
-                    {
-                        canDriver->onRecvCallback(canBusChannelID, (uint32_t &) id, data, dlc, softwareTime, canDriver);
-                    }
-                    catch(const std::exception& e)
-                    {
-                        Debug::error("%s", e.what());
-                    }
-                }
-                else
-                {
-                    stat = canReadStatus(handle, &statFlags);
-                    if (statFlags & canSTAT_SW_OVERRUN)
-                    {
-                        Debug::error("CANDriver - OnCANCallback: Software Overrun on can bus %d...", canBusChannelID);
-                    }
-                    else if (statFlags & canSTAT_HW_OVERRUN)
-                    {
-                        Debug::error("CANDriver - OnCANCallback: Hardware Overrun on can bus %d...", canBusChannelID);
-                    }
-                    else
-                    {
-                        Debug::error("CANDriver - OnCANCallback: canID: %d, dlc: %d, invalid msg on can bus %d detected, ignoring...", id, dlc, canBusChannelID);
-                    }
-                    Debug::print("\t\tCAN Status Flags: 0x%016x", statFlags);
-                }
-                
-                stat = canRead(handle, &id, data, &dlc, &flags, &timestamp);
-            }
-            // stat is either canERR_NOMSG or any different error code
-            if(stat != canOK && stat != canERR_NOMSG) {
-                std::string errorMsg = "canNOTIFY_RX: " +  canDriver->CANError(stat);
-                canDriver->onErrorCallback(&errorMsg);
-            }
-            break;
-        }
-        
         default:
-            //TODO: MP since this thread is managed by the canlib, should we really throw exceptions?
-            throw std::runtime_error("Callback got called with neither ERROR nor RX, gigantic UFF");
+            Debug::error("CANDriver - OnCANCallback: called with unknown event %u", event);
         break;
     }
 }
@@ -257,7 +384,7 @@ std::string CANDriverKvaser::CANError(canStatus status) {
 }
 
 
-canStatus CANDriverKvaser::InitializeCANChannel(uint32_t canBusChannelID) {
+canStatus CANDriverKvaser::InitializeCANChannel(uint32_t canBusChannelID, Receiver_t *receiver) {
     canStatus stat;
     canInitializeLibrary();
 
@@ -266,6 +393,7 @@ canStatus CANDriverKvaser::InitializeCANChannel(uint32_t canBusChannelID) {
     if(canHandlesMap[canBusChannelID] < 0){
         return (canStatus)canHandlesMap[canBusChannelID];
     }
+    receiver->handle = canHandlesMap[canBusChannelID];
 
     int timeScale = 1; //1us precision
     stat = canIoCtl(canHandlesMap[canBusChannelID], canIOCTL_SET_TIMER_SCALE, &timeScale, sizeof(timeScale));
@@ -307,8 +435,9 @@ canStatus CANDriverKvaser::InitializeCANChannel(uint32_t canBusChannelID) {
         return stat;
     }
 
-    // Register callback for receiving a msg when the rcv buffer has been empty or when an error frame got received
-    stat = kvSetNotifyCallback(canHandlesMap[canBusChannelID], (kvCallback_t) &CANDriverKvaser::OnCANCallback, (void *) this, canNOTIFY_RX | canNOTIFY_ERROR | canNOTIFY_STATUS);
+    // Register callback for receiving a msg when the rcv buffer has been empty or when an error frame got received,
+    // the receiver is the context so the callback needs no lookup of the bus
+    stat = kvSetNotifyCallback(canHandlesMap[canBusChannelID], (kvCallback_t) &CANDriverKvaser::OnCANCallback, (void *) receiver, canNOTIFY_RX | canNOTIFY_ERROR | canNOTIFY_STATUS);
     if(stat < 0) {
         return stat;
     }
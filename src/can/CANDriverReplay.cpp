@@ -0,0 +1,161 @@
+#include "can/CANDriverReplay.h"
+#include <chrono>
+#include "can_houbolt/can_cmds.h"
+#include "can_houbolt/channels/generic_channel_def.h"
+#include "utility/utils.h"
+
+
+CANDriverReplay::CANDriverReplay(std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback,
+                                 std::function<void(std::string *)> onErrorCallback, Config &config) :
+	CANDriver(onRecvCallback, onErrorCallback)
+{
+	nlohmann::json canConfig = config["/CAN"];
+	replayPath = canConfig["replay_path"];
+	if (utils::keyExists(canConfig, "replay_speed"))
+	{
+		replaySpeed = canConfig["replay_speed"];
+		if (replaySpeed < 0)
+		{
+			throw std::runtime_error("CANDriverReplay: replay_speed must not be negative");
+		}
+	}
+	if (utils::keyExists(canConfig, "replay_start_time"))
+	{
+		replayStartTime = canConfig["replay_start_time"];
+	}
+
+	CANRecordReader reader(replayPath);
+	if (!reader.Open())
+	{
+		throw std::runtime_error("CANDriverReplay: no recording found in " + replayPath);
+	}
+	CANRecord::Frame_t frame;
+	while (reader.Next(frame))
+	{
+		if (isNodeInfo(frame))
+		{
+			nodeInfos.push_back(frame);
+		}
+	}
+
+	if (replaySpeed == 0)
+	{
+		Debug::print("CANDriverReplay: replaying %s at max speed, %zu node infos found", replayPath.c_str(), nodeInfos.size());
+	}
+	else
+	{
+		Debug::print("CANDriverReplay: replaying %s at %gx, %zu node infos found", replayPath.c_str(), replaySpeed, nodeInfos.size());
+	}
+}
+
+CANDriverReplay::~CANDriverReplay()
+{
+	done = true;
+	if (replayThread.joinable()) replayThread.join();
+}
+
+void CANDriverReplay::Start()
+{
+	if (!replayThread.joinable())
+	{
+		replayThread = std::thread(&CANDriverReplay::replayLoop, this);
+	}
+}
+
+bool CANDriverReplay::isNodeInfo(const CANRecord::Frame_t &frame)
+{
+	if (frame.payloadLength < sizeof(Can_MessageDataInfo_t) + sizeof(uint8_t) || (frame.flags & CANRecord::FLAG_LORA))
+	{
+		return false;
+	}
+	Can_MessageId_t *canID = (Can_MessageId_t *) &frame.canID;
+	Can_MessageData_t *msg = (Can_MessageData_t *) frame.payload;
+	return canID->info.direction == NODE2MASTER_DIRECTION && msg->bit.info.channel_id == GENERIC_CHANNEL_ID && msg->bit.cmd_id == GENERIC_RES_NODE_INFO;
+}
+
+/**
+ * answers the node info request with the recorded responses, all other messages are discarded
+ */
+void CANDriverReplay::SendCANMessage(uint32_t canBusChannelID, uint32_t canID, uint8_t *payload, uint32_t payloadLength, bool blocking)
+{
+	Can_MessageData_t *msg = (Can_MessageData_t *) payload;
+	if (payloadLength > sizeof(Can_MessageDataInfo_t) && msg->bit.info.channel_id == GENERIC_CHANNEL_ID && msg->bit.cmd_id == GENERIC_REQ_NODE_INFO)
+	{
+		replayNodeInfos();
+	}
+}
+
+void CANDriverReplay::replayNodeInfos()
+{
+	std::lock_guard<std::mutex> lock(callbackMtx);
+	for (CANRecord::Frame_t frame : nodeInfos)
+	{
+		uint32_t payloadLength = frame.payloadLength;
+		onRecvCallback(frame.canBusChannelID, frame.canID, frame.payload, payloadLength, frame.timestamp, this);
+	}
+}
+
+std::map<std::string, bool> CANDriverReplay::GetCANStatusReadable(uint32_t canBusChannelID)
+{
+	std::map<std::string, bool> status;
+	return status;
+}
+
+void CANDriverReplay::replayLoop()
+{
+	CANRecordReader reader(replayPath);
+	if (!reader.Open())
+	{
+		Debug::error("CANDriverReplay: couldn't open %s", replayPath.c_str());
+		return;
+	}
+	if (replayStartTime != 0)
+	{
+		reader.Seek(replayStartTime);
+	}
+
+	Debug::print("CANDriverReplay: replay started");
+
+	CANRecord::Frame_t frame;
+	uint64_t frames = 0;
+	uint64_t firstTimestamp = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (!done && reader.Next(frame))
+	{
+		// lora frames were received by another driver, node infos were answered already
+		if ((frame.flags & CANRecord::FLAG_LORA) || frame.timestamp < replayStartTime || isNodeInfo(frame))
+		{
+			continue;
+		}
+
+		if (frames == 0)
+		{
+			firstTimestamp = frame.timestamp;
+		}
+		if (replaySpeed > 0 && frame.timestamp > firstTimestamp)
+		{
+			auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double, std::micro>((frame.timestamp - firstTimestamp) / replaySpeed));
+			// sleeping for single frames is too coarse, only catch up once a millisecond ahead
+			if (due - std::chrono::steady_clock::now() > std::chrono::milliseconds(1))
+			{
+				std::this_thread::sleep_until(due);
+			}
+		}
+
+		uint32_t payloadLength = frame.payloadLength;
+		try
+		{
+			std::lock_guard<std::mutex> lock(callbackMtx);
+			onRecvCallback(frame.canBusChannelID, frame.canID, frame.payload, payloadLength, frame.timestamp, this);
+		}
+		catch (const std::exception &e)
+		{
+			Debug::error("CANDriverReplay::replayLoop error: %s", e.what());
+		}
+		frames++;
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	Debug::print("CANDriverReplay: replay finished, %lu frames in %.3fs (%.0f frames/s)", frames, elapsed, elapsed > 0 ? frames / elapsed : 0.0);
+}
@@ -8,19 +8,101 @@
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include <linux/sockios.h>
-#include <poll.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <sys/epoll.h>
+#include <pthread.h>
 #include "can_houbolt/can_cmds.h"
 #include "utility/utils.h"
 
 
 CANDriverSocketCAN::CANDriverSocketCAN(std::function<void(uint8_t &, uint32_t &, uint8_t *, uint32_t &, uint64_t &, CANDriver *driver)> onRecvCallback,
-									   std::function<void(std::string *)> onErrorCallback, Config &config) :
-	CANDriver(onRecvCallback, onErrorCallback)
+									   std::function<void(std::string *)> onErrorCallback, Config &config,
+									   std::function<void(std::span<CANFrame_t>, CANDriver *driver)> onRecvBatchCallback) :
+	CANDriver(onRecvCallback, onErrorCallback, onRecvBatchCallback)
 {
 	canDevices = (std::vector<std::string>)config["/CAN/DEVICE"];
 
+	nlohmann::json canConfig = config["/CAN"];
+	if (utils::keyExists(canConfig, "receive_batch_size"))
+	{
+		receiveBatchSize = canConfig["receive_batch_size"];
+		if (receiveBatchSize == 0) throw std::runtime_error("CAN receive_batch_size must be greater than 0");
+	}
+	if (utils::keyExists(canConfig, "hardware_timestamps"))
+	{
+		useHardwareTimestamps = canConfig["hardware_timestamps"];
+	}
+
+	if (utils::keyExists(canConfig, "receive_thread_per_bus"))
+	{
+		receiveThreadPerBus = canConfig["receive_thread_per_bus"];
+	}
+	if (utils::keyExists(canConfig, "receive_thread_cores"))
+	{
+		receiveThreadCores = (std::vector<int>)canConfig["receive_thread_cores"];
+	}
+
+	if (canDevices.empty() || canDevices.size() > 256) throw std::runtime_error("CAN DEVICE must list 1 to 256 devices");
+
+	buses.resize(canDevices.size());
+	for (size_t i = 0; i < canDevices.size(); i++)
+	{
+		buses[i].device = canDevices[i];
+		buses[i].canBusChannelID = i;
+		buses[i].socket = openSocket(canDevices[i]);
+	}
+
+	if (utils::keyExists(canConfig, "canBusChannelIDs"))
+	{
+		for (int canBusChannelID : (std::vector<int>)canConfig["canBusChannelIDs"])
+		{
+			if (canBusChannelID < 0 || (size_t) canBusChannelID >= buses.size())
+			{
+				Debug::warning("CANDriverSocketCAN: no device for can bus %d, messages to it are discarded", canBusChannelID);
+			}
+		}
+	}
+
+	size_t transmitQueueSize = 1024;
+	size_t transmitBatchSize = 32;
+	if (utils::keyExists(canConfig, "transmit_queue_size"))
+	{
+		transmitQueueSize = canConfig["transmit_queue_size"];
+	}
+	if (utils::keyExists(canConfig, "transmit_batch_size"))
+	{
+		transmitBatchSize = canConfig["transmit_batch_size"];
+	}
+	std::vector<uint32_t> busIDs;
+	for (Bus_t &bus : buses) busIDs.push_back(bus.canBusChannelID);
+	transmitQueue = new CANTransmitQueue(busIDs, std::bind(&CANDriverSocketCAN::sendBatch, this, std::placeholders::_1, std::placeholders::_2),
+										 transmitQueueSize, transmitBatchSize);
+
+	// start threads that handle incoming messages
+	if (receiveThreadPerBus)
+	{
+		for (size_t i = 0; i < buses.size(); i++)
+		{
+			int core = i < receiveThreadCores.size() ? receiveThreadCores[i] : -1;
+			receiveThreads.emplace_back(&CANDriverSocketCAN::receiveLoop, this, std::vector<Bus_t *>{&buses[i]}, core);
+		}
+	}
+	else
+	{
+		std::vector<Bus_t *> allBuses;
+		for (Bus_t &bus : buses) allBuses.push_back(&bus);
+		int core = receiveThreadCores.empty() ? -1 : receiveThreadCores[0];
+		receiveThreads.emplace_back(&CANDriverSocketCAN::receiveLoop, this, allBuses, core);
+	}
+
+	Debug::print("CANDriverSocketCAN: init with %zu devices and %zu receive threads done.", buses.size(), receiveThreads.size());
+}
+
+int CANDriverSocketCAN::openSocket(const std::string &device)
+{
 	// create can socket
-	canSocket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	int canSocket = socket(PF_CAN, SOCK_RAW, CAN_RAW);
 	if(canSocket < 0) throw std::runtime_error("CAN socket creation failed");
 
 	//switch to FD mode
@@ -30,8 +112,9 @@ CANDriverSocketCAN::CANDriverSocketCAN(std::function<void(uint8_t &, uint32_t &,
 
 	// find interface index of our can device
 	struct ifreq ifr;
-	strcpy(ifr.ifr_name, canDevices[0].c_str());
-	ioctl(canSocket, SIOCGIFINDEX, &ifr);
+	if (device.size() >= IFNAMSIZ) throw std::runtime_error("CAN device name " + device + " too long");
+	strcpy(ifr.ifr_name, device.c_str());
+	if (ioctl(canSocket, SIOCGIFINDEX, &ifr) < 0) throw std::runtime_error("CAN device " + device + " not found");
 
 	// TODO: set bit timing (e.g. using libsocketcan when it starts supporting CAN FD), currently must be set using ip link
 
@@ -42,49 +125,90 @@ CANDriverSocketCAN::CANDriverSocketCAN(std::function<void(uint8_t &, uint32_t &,
 	if(setsockopt(canSocket, SOL_CAN_RAW, CAN_RAW_FILTER, &rfilter, sizeof(rfilter)))
 		throw std::runtime_error("CAN adding filter failed");
 
-	// TODO: if using multiple interfaces, the interface index can be set to zero to bind to all (block above not needed). recvfrom and sendto should be used in that case
+	// receive timestamps as control message with every frame instead of an ioctl per frame
+	int timestampFlags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	if (useHardwareTimestamps) timestampFlags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	if(setsockopt(canSocket, SOL_SOCKET, SO_TIMESTAMPING, &timestampFlags, sizeof(timestampFlags)))
+		throw std::runtime_error("CAN enabling timestamps failed");
+
 	// bind socket to candevice
 	struct sockaddr_can addr;
 	memset(&addr, 0, sizeof(addr));
 	addr.can_family = AF_CAN;
 	addr.can_ifindex = ifr.ifr_ifindex;
-	if(bind(canSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0) throw std::runtime_error("CAN socket bind failed");
+	if(bind(canSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0) throw std::runtime_error("CAN socket bind to " + device + " failed");
 
-	// start thread that handles incoming messages
-	receiveThread = new std::thread(&CANDriverSocketCAN::receiveLoop, this);
-
-	Debug::print("CANDriverSocketCAN: init with device %s done.", canDevices[0].c_str());
+	return canSocket;
 }
 
 CANDriverSocketCAN::~CANDriverSocketCAN()
 {
+	// receive threads may still forward frames through the transmit queue until they are joined
 	done = true;
-	if(receiveThread->joinable()) receiveThread->join();
-	else Debug::warning("receiveThread was not joinable.");
-	delete receiveThread;
-	close(canSocket);
+	for (std::thread &receiveThread : receiveThreads)
+	{
+		if(receiveThread.joinable()) receiveThread.join();
+		else Debug::warning("receiveThread was not joinable.");
+	}
+
+	// sends what is still queued
+	delete transmitQueue;
+
+	for (Bus_t &bus : buses)
+	{
+		close(bus.socket);
+	}
 }
 
 
 void CANDriverSocketCAN::SendCANMessage(uint32_t canChannelID, uint32_t canID, uint8_t *payload, uint32_t payloadLength, bool blocking)
 {
-	if(canChannelID > 0) return; // TODO: support multiple devices, use canChannelID
+	if(canChannelID >= buses.size()) return; // no device configured for this bus, warned about on init
 
     if(payloadLength > MAX_DATA_SIZE) throw std::runtime_error("CANDriver - SendCANMessage: payload length " + std::to_string(payloadLength) + " exceeds supported can fd msg data size " + std::to_string(MAX_DATA_SIZE));
 
-	struct canfd_frame frame;
-	frame.can_id = canID & 0x7FF; // remove flags, use 0x1FFFFFFF to support extended IDs
-	frame.can_id |= 0; // no flags, use 0x80000000 for extended ID
-	frame.len = payloadLength;
-	std::memcpy(frame.data, payload, payloadLength);
+	//TODO wait for completion if blocking. is this possible?
+	transmitQueue->Push(canChannelID, canID, payload, payloadLength, blocking);
+}
+
+void CANDriverSocketCAN::sendBatch(uint32_t canBusChannelID, std::span<TxFrame_t> frames)
+{
+	// only called from the transmit thread of the bus
+	thread_local std::vector<struct canfd_frame> canFrames;
+	thread_local std::vector<struct iovec> iovecs;
+	thread_local std::vector<struct mmsghdr> msgs;
+	canFrames.resize(frames.size());
+	iovecs.resize(frames.size());
+	msgs.resize(frames.size());
 
-	if(write(canSocket, &frame, sizeof(struct canfd_frame)) != sizeof(struct canfd_frame))
+	for (size_t i = 0; i < frames.size(); i++)
 	{
-		Debug::print("Errno: 0x%x", errno);
-		throw std::runtime_error("CAN write failed");
+		struct canfd_frame &frame = canFrames[i];
+		memset(&frame, 0, sizeof(frame));
+		frame.can_id = frames[i].canID & 0x7FF; // remove flags, use 0x1FFFFFFF to support extended IDs
+		frame.can_id |= 0; // no flags, use 0x80000000 for extended ID
+		frame.len = frames[i].payloadLength;
+		std::memcpy(frame.data, frames[i].payload, frames[i].payloadLength);
+
+		iovecs[i].iov_base = &frame;
+		iovecs[i].iov_len = sizeof(struct canfd_frame);
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
 	}
 
-	//TODO wait for completion if blocking. is this possible?
+	size_t sent = 0;
+	while (sent < frames.size())
+	{
+		int ret = sendmmsg(buses[canBusChannelID].socket, &msgs[sent], frames.size() - sent, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR) continue;
+			Debug::print("Errno: 0x%x", errno);
+			throw std::runtime_error("CAN write failed");
+		}
+		sent += ret;
+	}
 }
 
 
@@ -96,49 +220,154 @@ std::map<std::string, bool> CANDriverSocketCAN::GetCANStatusReadable(uint32_t ca
 }
 
 
-void CANDriverSocketCAN::receiveLoop() // TODO: read errors, call onErrorCallback(&errorMsg);
+/**
+ * @return hardware timestamp if enabled and available, else the software receive timestamp, in microseconds
+ */
+uint64_t CANDriverSocketCAN::getTimestamp(struct msghdr &msg)
 {
-	while(!done)
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
 	{
-		// wait for data getting received
-		struct pollfd fd = {.fd = canSocket, .events = POLLIN};
-		int pollRet = poll(&fd, 1, 200); // 200ms timeout
-		if(pollRet < 0)
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
 		{
-			std::cerr << "Error polling canSocket" << errno << std::endl;
-			done = true;
-			return;
+			struct scm_timestamping *timestamps = (struct scm_timestamping *) CMSG_DATA(cmsg);
+			// ts[0] software, ts[2] raw hardware
+			struct timespec *ts = &timestamps->ts[0];
+			if (useHardwareTimestamps && (timestamps->ts[2].tv_sec != 0 || timestamps->ts[2].tv_nsec != 0))
+			{
+				ts = &timestamps->ts[2];
+			}
+			return (uint64_t)ts->tv_sec * 1000000 + (uint64_t)ts->tv_nsec / 1000;
 		}
-		if(pollRet == 0) // timeout
+	}
+	return utils::getCurrentTimestamp();
+}
+
+void CANDriverSocketCAN::receiveLoop(std::vector<Bus_t *> receiveBuses, int core) // TODO: read errors, call onErrorCallback(&errorMsg);
+{
+	if (core >= 0)
+	{
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		CPU_SET(core, &cpuSet);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0)
 		{
-//			std::cout << "canSocket poll timeout" << std::endl;
-			if(done) break;
-			continue;
+			Debug::warning("CANDriverSocketCAN::receiveLoop: couldn't pin receive thread to core %d", core);
 		}
+	}
 
-		struct canfd_frame frame;
-		int size = sizeof(frame);
-		int readLength = read(canSocket, &frame, size);
-		if(readLength < 0) throw std::runtime_error("CAN read failed");
-		else if(readLength < size) throw std::runtime_error("CAN read incomplete");
+	int epollFD = epoll_create1(0);
+	if (epollFD < 0)
+	{
+		std::cerr << "Error creating epoll instance" << errno << std::endl;
+		done = true;
+		return;
+	}
+	for (size_t i = 0; i < receiveBuses.size(); i++)
+	{
+		struct epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.u32 = i;
+		if (epoll_ctl(epollFD, EPOLL_CTL_ADD, receiveBuses[i]->socket, &event) < 0)
+		{
+			std::cerr << "Error adding canSocket to epoll" << errno << std::endl;
+			close(epollFD);
+			done = true;
+			return;
+		}
+	}
 
-		//TODO: switch timestamp to current unix time
-		struct timeval timestamp;
-		ioctl(canSocket, SIOCGSTAMP, &timestamp);
-		uint64_t timestamp_us = (uint64_t)timestamp.tv_sec * 1e6 + (uint64_t)timestamp.tv_usec;
+	// buffers of the batch receive, reused for every bus of this thread
+	constexpr size_t controlSize = CMSG_SPACE(sizeof(struct scm_timestamping));
+	std::vector<struct canfd_frame> frames(receiveBatchSize);
+	std::vector<struct iovec> iovecs(receiveBatchSize);
+	std::vector<struct mmsghdr> msgs(receiveBatchSize);
+	std::vector<uint8_t> control(receiveBatchSize * controlSize);
+	std::vector<CANFrame_t> batch(receiveBatchSize);
 
-		uint8_t canChannelID = 0; // TODO support multiple devices
+	for (uint32_t i = 0; i < receiveBatchSize; i++)
+	{
+		iovecs[i].iov_base = &frames[i];
+		iovecs[i].iov_len = sizeof(struct canfd_frame);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_control = &control[i * controlSize];
+	}
 
-		frame.can_id &= 0x1FFFFFFF;
+	std::vector<struct epoll_event> events(receiveBuses.size());
+	while(!done)
+	{
+		int ready = epoll_wait(epollFD, events.data(), events.size(), 200); // 200ms timeout
+		if(ready < 0)
+		{
+			if (errno == EINTR) continue;
+			std::cerr << "Error polling canSocket" << errno << std::endl;
+			done = true;
+			break;
+		}
 
-		try
+		for (int i = 0; i < ready; i++)
 		{
-			onRecvCallback(canChannelID, (uint32_t&)frame.can_id, frame.data, (uint32_t&)frame.len, timestamp_us, this);
+			Bus_t *bus = receiveBuses[events[i].data.u32];
+			// a full batch means there is probably more queued already, one batch per bus at a time keeps it fair
+			while (receiveBatch(bus, msgs.data(), frames.data(), batch.data()) && ready == 1 && !done)
+			{
+			}
 		}
-		catch(const std::exception& e)
+	}
+	close(epollFD);
+}
+
+/**
+ * reads up to receiveBatchSize frames of the bus with one recvmmsg call and delivers them
+ * @return true if the batch was full
+ */
+bool CANDriverSocketCAN::receiveBatch(Bus_t *bus, struct mmsghdr *msgs, struct canfd_frame *frames, CANFrame_t *batch)
+{
+	constexpr size_t controlSize = CMSG_SPACE(sizeof(struct scm_timestamping));
+
+	// the kernel overwrites the lengths, reset them for every call
+	for (uint32_t i = 0; i < receiveBatchSize; i++)
+	{
+		msgs[i].msg_hdr.msg_name = nullptr;
+		msgs[i].msg_hdr.msg_namelen = 0;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_controllen = controlSize;
+		msgs[i].msg_hdr.msg_flags = 0;
+	}
+
+	int received = recvmmsg(bus->socket, msgs, receiveBatchSize, MSG_DONTWAIT, nullptr);
+	if(received < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return false;
+		throw std::runtime_error("CAN read on " + bus->device + " failed");
+	}
+
+	size_t count = 0;
+	for (int i = 0; i < received; i++)
+	{
+		// classic can frames arrive with CAN_MTU on a fd socket, their len is valid as well
+		if (msgs[i].msg_len != CANFD_MTU && msgs[i].msg_len != CAN_MTU)
 		{
-			Debug::error("CANDriverSocketCAN::receiveLoop error: %s", e.what());
+			Debug::warning("CANDriverSocketCAN::receiveLoop: incomplete frame of %u bytes discarded", msgs[i].msg_len);
+			continue;
 		}
-		
+		struct canfd_frame &frame = frames[i];
+		frame.can_id &= 0x1FFFFFFF;
+
+		CANFrame_t &canFrame = batch[count++];
+		canFrame.canBusChannelID = bus->canBusChannelID;
+		canFrame.canID = frame.can_id;
+		canFrame.payload = frame.data;
+		canFrame.payloadLength = frame.len;
+		canFrame.timestamp = getTimestamp(msgs[i].msg_hdr);
+	}
+
+	try
+	{
+		deliverBatch(std::span<CANFrame_t>(batch, count));
+	}
+	catch(const std::exception& e)
+	{
+		Debug::error("CANDriverSocketCAN::receiveLoop error: %s", e.what());
 	}
+	return (uint32_t) received == receiveBatchSize;
 }
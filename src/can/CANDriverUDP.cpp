@@ -1,5 +1,6 @@
 #include "can/CANDriverUDP.h"
 #include "can_houbolt/can_cmds.h"
+#include <array>
 #include <string>
 #include <sys/socket.h>
 #include <net/if.h>
@@ -35,6 +36,16 @@ CANDriverUDP::CANDriverUDP(std::function<void(uint8_t &, uint32_t &, uint8_t *,
 		throw std::runtime_error("nodeIDs and canMsgSizes in config don't have the same length");
 	}
 
+	nlohmann::json loraConfig = config["/LORA"];
+	if (utils::keyExists(loraConfig, "hexdump"))
+	{
+		hexdump = loraConfig["hexdump"];
+	}
+
+	//one byte more than a valid datagram, so longer ones are detected
+	receiveSlotSize = FRAME_HEADROOM + MSG_HEADER_SIZE + totalRequiredMsgPayloadSize + 1 + sizeof(Can_MessageData_t);
+	receiveBuffer.resize(RECEIVE_BATCH_SIZE * receiveSlotSize, 0);
+
     socket = new UDPSocket("CAN_UDPSocket", std::bind(&CANDriverUDP::Close, this), sendIP, sendPort);
     while(socket->Connect()!=0);
     
@@ -63,78 +74,100 @@ CANDriverUDP::~CANDriverUDP()
 
 void CANDriverUDP::AsyncListen()
 {
-	UDPMessage msg = {0};
+	std::array<UDPMessage, RECEIVE_BATCH_SIZE> msgs;
     while(!shallClose)
     {
         
         try {
-            socket->Recv(&msg);
-
-			if (msg.dataLength <= 0)
+			for (size_t i = 0; i < msgs.size(); i++)
 			{
-				Debug::error("CANDriverUDP - AsyncListen: msg length smaller than one, ignoring message...");
-				continue;
+				msgs[i].data = &receiveBuffer[i * receiveSlotSize + FRAME_HEADROOM];
+				msgs[i].dataLength = MSG_HEADER_SIZE + totalRequiredMsgPayloadSize + 1;
 			}
-			
-			uint8_t canBusChannelID = 0;
-			uint8_t *payload = msg.data;
+			size_t received = socket->RecvBatch(msgs.data(), msgs.size());
+
+			//the datagrams of a burst were queued together
 			uint64_t timestamp = utils::getCurrentTimestamp();
-			if (msg.dataLength != totalRequiredMsgPayloadSize + MSG_HEADER_SIZE)
+			for (size_t i = 0; i < received; i++)
 			{
-				Debug::error("CANDriverUDP - AsyncListen: msg length is too short or too long\n\t\trequired: %d, actual %d\n\t\tignoring message...", totalRequiredMsgPayloadSize+MSG_HEADER_SIZE, msg.dataLength);
-				continue;
+				ProcessDatagram(msgs[i].data, msgs[i].dataLength, timestamp);
 			}
+            
+        } catch (const std::exception& e) {
+            Debug::error("CANDriverUDP - AsyncListen: %s", e.what());
+        }
 
-			for (size_t i=0; i < msg.dataLength; ++i)
-			{
-					if (i % 8 == 0)
-					{
-							printf("\n%zd\t", i);
-					}
-					printf("0x%02x ", msg.data[i]);
-			}
-			printf("\n");
+    }
+}
 
-			//create canid
-			Can_MessageId_t canID = {0};
-			canID.info.direction = NODE2MASTER_DIRECTION;
-			canID.info.priority = STANDARD_PRIORITY;
-			canID.info.special_cmd = STANDARD_SPECIAL_CMD;
+void CANDriverUDP::ProcessDatagram(uint8_t *data, size_t dataLength, uint64_t timestamp)
+{
+	if (dataLength == 0)
+	{
+		Debug::error("CANDriverUDP - AsyncListen: msg length smaller than one, ignoring message...");
+		return;
+	}
 
-			Can_MessageData_t command = {0};
-			command.bit.info.buffer = DIRECT_BUFFER;
-			command.bit.info.channel_id = GENERIC_CHANNEL_ID;
-			command.bit.cmd_id = GENERIC_RES_DATA;
+	if (dataLength != totalRequiredMsgPayloadSize + MSG_HEADER_SIZE)
+	{
+		Debug::error("CANDriverUDP - AsyncListen: msg length is too short or too long\n\t\trequired: %d, actual %zu\n\t\tignoring message...", totalRequiredMsgPayloadSize+MSG_HEADER_SIZE, dataLength);
+		return;
+	}
 
-			for (size_t i = 0; i < nodeIDs.size(); i++)
+	if (hexdump)
+	{
+		//8 bytes per line, printed at once
+		std::string dump;
+		dump.reserve(dataLength * 5 + dataLength / 2);
+		char byteString[8];
+		for (size_t i = 0; i < dataLength; ++i)
+		{
+			if (i % 8 == 0)
 			{
-				switch (payload[0])
-				{
-					case (uint8_t)CanMessageOption::USED:
-						{
-							canID.info.node_id = nodeIDs[i];
-							std::memcpy(command.bit.data.uint8, &payload[CAN_MSG_HEADER_SIZE], canMsgSizes[i]);
-							onRecvCallback(canBusChannelID, canID.uint32, command.uint8, canMsgSizes[i], timestamp, this);
-							//Node::FlushLogger();
-						}
-						break;
-					case (uint8_t)CanMessageOption::EMPTY:
-						Debug::info("CANDriverUDP - AsyncListen: empty can message recieved, ignoring block...");
-						break;
-					default:
-						Debug::error("CANDriverUDP - AsyncListen: CanMessageOption 0x%02x not recognized, ignoring can msg", payload[0]);
-						continue;
-				}
-				payload += CAN_MSG_HEADER_SIZE + canMsgSizes[i];
-				
+				dump += "\n" + std::to_string(i) + "\t";
 			}
+			snprintf(byteString, sizeof(byteString), "0x%02x ", data[i]);
+			dump += byteString;
+		}
+		Debug::print("CANDriverUDP - received %zu bytes:%s", dataLength, dump.c_str());
+	}
 
-            
-        } catch (const std::exception& e) {
-            Debug::error("CANDriverUDP - AsyncListen: %s", e.what());
-        }
+	uint8_t canBusChannelID = 0;
 
-    }
+	//create canid
+	Can_MessageId_t canID = {0};
+	canID.info.direction = NODE2MASTER_DIRECTION;
+	canID.info.priority = STANDARD_PRIORITY;
+	canID.info.special_cmd = STANDARD_SPECIAL_CMD;
+
+	uint8_t *block = data + MSG_HEADER_SIZE;
+	for (size_t i = 0; i < nodeIDs.size(); i++)
+	{
+		switch (block[0])
+		{
+			case (uint8_t)CanMessageOption::USED:
+				{
+					Can_MessageData_t *command = (Can_MessageData_t *) (block + CAN_MSG_HEADER_SIZE - FRAME_HEADER_SIZE);
+					command->bit.info.buffer = DIRECT_BUFFER;
+					command->bit.info.channel_id = GENERIC_CHANNEL_ID;
+					command->bit.cmd_id = GENERIC_RES_DATA;
+
+					canID.info.node_id = nodeIDs[i];
+					uint32_t canIDValue = canID.uint32;
+					//the frame header in front of the block counts towards the frame length
+					uint32_t payloadLength = canMsgSizes[i] + FRAME_HEADER_SIZE;
+					onRecvCallback(canBusChannelID, canIDValue, command->uint8, payloadLength, timestamp, this);
+				}
+				break;
+			case (uint8_t)CanMessageOption::EMPTY:
+				Debug::info("CANDriverUDP - AsyncListen: empty can message recieved, ignoring block...");
+				break;
+			default:
+				Debug::error("CANDriverUDP - AsyncListen: CanMessageOption 0x%02x not recognized, ignoring can msg", block[0]);
+				break;
+		}
+		block += CAN_MSG_HEADER_SIZE + canMsgSizes[i];
+	}
 }
 
 void CANDriverUDP::SendCANMessage(uint32_t canChannelID, uint32_t canID, uint8_t *payload, uint32_t payloadLength, bool blocking)
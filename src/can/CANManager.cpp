@@ -2,7 +2,10 @@
 // Created by Markus on 03.04.21.
 //
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <fstream>
 #include <thread>
 #include <future>
 #include <utility>
@@ -11,15 +14,20 @@
 #include "can/CANDriverKvaser.h"
 #include "can/CANDriverSocketCAN.h"
 #include "can/CANDriverUDP.h"
+#include "can/CANDriverReplay.h"
 #include "can_houbolt/channels/generic_channel_def.h"
 
 #include "StateController.h"
 #include "EventManager.h"
+#include "utility/utils.h"
 
 CANManager::~CANManager()
 {
+    sensorLogDone = true;
+    if (sensorLogThread.joinable()) sensorLogThread.join();
     delete mapping;
     delete canDriver;
+    CANRecorder::Destroy();
 }
 
 bool CANManager::IsInitialized()
@@ -61,6 +69,13 @@ CANResult CANManager::Init(Config &config)
 
 			Node::InitConfig(config);
 
+			// before any driver is created, so the node discovery is recorded too
+			recorder = CANRecorder::Instance();
+			if (can_driver != "Replay")
+			{
+				recorder->Init(config);
+			}
+
             if(can_driver == "Kvaser")
             {
 				#ifdef NO_CANLIB
@@ -69,14 +84,23 @@ CANResult CANManager::Init(Config &config)
 				#else
             	Debug::print("Using Kvaser CAN driver");
 				canDriver = new CANDriverKvaser(std::bind(&CANManager::OnCANRecv,  this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5, std::placeholders::_6),
-				                                std::bind(&CANManager::OnCANError, this, std::placeholders::_1), canBusChannelIDs, config);
+				                                std::bind(&CANManager::OnCANError, this, std::placeholders::_1), canBusChannelIDs, config,
+				                                std::bind(&CANManager::OnCANRecvBatch, this, std::placeholders::_1, std::placeholders::_2));
 				#endif
             }
             else if(can_driver == "SocketCAN")
 			{
             	Debug::print("Using SocketCAN driver");
             	canDriver = new CANDriverSocketCAN(std::bind(&CANManager::OnCANRecv,  this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5, std::placeholders::_6),
+				                                   std::bind(&CANManager::OnCANError, this, std::placeholders::_1), config,
+				                                   std::bind(&CANManager::OnCANRecvBatch, this, std::placeholders::_1, std::placeholders::_2));
+			}
+            else if(can_driver == "Replay")
+			{
+            	Debug::print("Using Replay driver");
+            	replayDriver = new CANDriverReplay(std::bind(&CANManager::OnCANRecv,  this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5, std::placeholders::_6),
 				                                   std::bind(&CANManager::OnCANError, this, std::placeholders::_1), config);
+            	canDriver = replayDriver;
 			}
             else
             {
@@ -111,6 +135,39 @@ CANResult CANManager::Init(Config &config)
             	Debug::print("auto_start not found in config, using default true");
             }
 
+            uint32_t nodeCount = config["/CAN/node_count"];
+
+            //node info is requested again after nodeRequestInterval, which doubles up to nodeRequestMaxInterval
+            nlohmann::json canConfig = config["/CAN"];
+            std::chrono::milliseconds nodeRequestInterval(100);
+            std::chrono::milliseconds nodeRequestMaxInterval(2000);
+            if (utils::keyExists(canConfig, "node_request_interval"))
+            {
+            	nodeRequestInterval = std::chrono::milliseconds(canConfig["node_request_interval"].get<int64_t>());
+            }
+            if (utils::keyExists(canConfig, "node_request_max_interval"))
+            {
+            	nodeRequestMaxInterval = std::chrono::milliseconds(canConfig["node_request_max_interval"].get<int64_t>());
+            }
+            //without an expected node count, nodes are discovered until the timeout
+            std::chrono::milliseconds nodeDiscoveryTimeout(500);
+            if (utils::keyExists(canConfig, "node_discovery_timeout"))
+            {
+            	nodeDiscoveryTimeout = std::chrono::milliseconds(canConfig["node_discovery_timeout"].get<int64_t>());
+            }
+            if (utils::keyExists(canConfig, "node_inventory_file"))
+            {
+            	nodeInventoryPath = canConfig["node_inventory_file"];
+            }
+
+            //nodes are only constructed from node infos received now, the inventory of the last run only ends the discovery
+            //as soon as all its nodes answered
+            bool inventoryLoaded = LoadNodeInventory(nodeCount);
+            if (inventoryLoaded)
+            {
+            	Debug::print("Expecting %zu nodes from node inventory %s", expectedNodes.size(), nodeInventoryPath.c_str());
+            }
+
             Debug::print("Retreiving CANHardware info...");
 
             if(!autoStart)
@@ -125,46 +182,87 @@ CANResult CANManager::Init(Config &config)
 				std::vector<uint32_t> loraBusChannels = {0};
 				//RequestCANInfo(loraDriver, loraBusChannels);
 			}
-            using namespace std::chrono_literals;
-            //TODO: wait for user input or expected node count to continue
-			
-            uint32_t nodeCount = config["/CAN/node_count"];
-            uint32_t currNodeCount = 0;
 
             bool canceled = false;
             std::future<bool> future;
-            if(!autoStart)
+            if(!autoStart && !canceled)
             {
 				future = std::async([](){
 						std::cin.get();
 						return true;
 					});
             }
-			
-			uint32_t counter = 0;
-            do {
-                if(autoStart)
-				{
-                	Debug::print("Waiting for nodes %d of %d...", currNodeCount, nodeCount);
-                	std::this_thread::sleep_for(500ms);
-                }
-                else
-                {
-                	Debug::print("Waiting for nodes %d of %d, press enter to continue...", currNodeCount, nodeCount);
-					if (future.wait_for(500ms) == std::future_status::ready)
-						canceled = true;
-                }
-                nodeMapMtx.lock();
-                currNodeCount = nodeMap.size();
-                nodeMapMtx.unlock();
-				if (++counter % 4 == 0)
-				{
-					Debug::print("Resending node info...");
-					RequestCANInfo(canDriver, canBusChannelIDs);
-					counter = 0;
-				}
+
+            auto nextRequest = std::chrono::steady_clock::now() + nodeRequestInterval;
+            auto discoveryEnd = std::chrono::steady_clock::now() + nodeDiscoveryTimeout;
+            std::unique_lock<std::mutex> discoveryLock(nodeMapMtx);
+            while (!canceled)
+            {
+            	if (!pendingNodeIDs.empty())
+            	{
+            		std::vector<DiscoveredNode_t> nodes = TakePendingNodes();
+            		discoveryLock.unlock();
+            		InitializeNodes(std::move(nodes));
+            		discoveryLock.lock();
+            		continue;
+            	}
+            	bool expectedNodesAnswered = inventoryLoaded && std::all_of(expectedNodes.begin(), expectedNodes.end(), [this](auto &node) {
+            		return nodeInventory.count(node.first) > 0;
+            	});
+            	if (nodeCount > 0 ? nodeMap.size() >= nodeCount : (expectedNodesAnswered || std::chrono::steady_clock::now() >= discoveryEnd))
+            	{
+            		break;
+            	}
+
+            	//woken by every node info, console input is polled
+            	auto wakeUp = nodeCount > 0 ? nextRequest : std::min(nextRequest, discoveryEnd);
+            	if (!autoStart)
+            	{
+            		wakeUp = std::min(wakeUp, std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
+            	}
+            	nodeDiscoveredCV.wait_until(discoveryLock, wakeUp, [this](){ return !pendingNodeIDs.empty(); });
+
+            	if (!autoStart && future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            	{
+            		canceled = true;
+            	}
+            	else if (pendingNodeIDs.empty() && std::chrono::steady_clock::now() >= nextRequest)
+            	{
+            		size_t currNodeCount = nodeMap.size();
+            		discoveryLock.unlock();
+            		if (nodeCount > 0)
+            		{
+            			Debug::print("Waiting for nodes %zu of %d, resending node info...", currNodeCount, nodeCount);
+            		}
+            		else
+            		{
+            			Debug::print("Waiting for nodes, %zu found, resending node info...", currNodeCount);
+            		}
+            		RequestCANInfo(canDriver, canBusChannelIDs);
+            		discoveryLock.lock();
+            		nodeRequestInterval = std::min(nodeRequestInterval * 2, nodeRequestMaxInterval);
+            		nextRequest = std::chrono::steady_clock::now() + nodeRequestInterval;
+            	}
             }
-            while((currNodeCount < nodeCount) && !canceled);
+            //node infos arriving from now on only update the inventory
+            discoveryClosed = true;
+            std::vector<DiscoveredNode_t> lateNodes = TakePendingNodes();
+            bool inventoryChanged = nodeInventory.size() != expectedNodes.size();
+            for (auto &[nodeID, expected] : expectedNodes)
+            {
+            	auto it = nodeInventory.find(nodeID);
+            	if (it == nodeInventory.end())
+            	{
+            		Debug::error("Node %d of the node inventory didn't answer, it is not initialized and removed from the inventory", nodeID);
+            		inventoryChanged = true;
+            	}
+            	else if (std::memcmp(&it->second.nodeInfo, &expected.nodeInfo, sizeof(NodeInfoMsg_t)) != 0)
+            	{
+            		inventoryChanged = true;
+            	}
+            }
+            discoveryLock.unlock();
+            InitializeNodes(std::move(lateNodes));
 
             Debug::print("Check for version differences...\n");
             std::vector<uint32_t> versions;
@@ -192,7 +290,31 @@ CANResult CANManager::Init(Config &config)
             	std::cin.get();
 			}
 
+            // the receive path reads the node table without locking from now on
+            nodeMapMtx.lock();
+            std::vector<std::pair<Node *, SensorRingReader>> sensorLogReaders;
+            for (auto &node : nodeMap)
+            {
+                nodeTable[node.first] = node.second;
+                // sensor frames are only decoded once initialized, so the readers don't miss any sample
+                sensorLogReaders.emplace_back(node.second, SensorRingReader(node.second->GetSensorRingBuffer()));
+            }
+            if (Node::IsFastLoggingEnabled())
+            {
+                sensorLogThread = std::thread(&CANManager::SensorLogLoop, this, std::move(sensorLogReaders));
+            }
             initialized = true;
+            if (inventoryChanged)
+            {
+                SaveNodeInventory();
+            }
+            nodeMapMtx.unlock();
+
+            // the recorded frames would have been discarded before the initialization
+            if (replayDriver != nullptr)
+            {
+                replayDriver->Start();
+            }
 
 			Debug::print("Request current state and config from nodes...\n");
 			//RequestCurrentState();
@@ -243,6 +365,41 @@ CANResult CANManager::RequestCANInfo(CANDriver *driver, std::vector<uint32_t> &c
 	return CANResult::SUCCESS;
 }
 
+void CANManager::SensorLogLoop(std::vector<std::pair<Node *, SensorRingReader>> readers)
+{
+    std::array<ChannelSensorData_t, 256> buffer;
+    uint64_t reportedOverruns = 0;
+    auto nextOverrunCheck = std::chrono::steady_clock::now();
+    while (!sensorLogDone)
+    {
+        size_t logged = 0;
+        for (auto &[node, reader] : readers)
+        {
+            logged += node->LogSensorSamples(reader, buffer);
+        }
+
+        if (std::chrono::steady_clock::now() >= nextOverrunCheck)
+        {
+            uint64_t overruns = 0;
+            for (auto &[node, reader] : readers)
+            {
+                overruns += reader.GetOverrunCount();
+            }
+            if (overruns > reportedOverruns)
+            {
+                Debug::warning("CANManager: fast logger couldn't keep up, %lu samples lost, consider raising sensor_ring_buffer_size", overruns - reportedOverruns);
+                reportedOverruns = overruns;
+            }
+            nextOverrunCheck += std::chrono::seconds(1);
+        }
+
+        if (logged == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
 void CANManager::RequestCurrentState()
 {
 	Node *currNode;
@@ -254,58 +411,200 @@ void CANManager::RequestCurrentState()
     }
 }
 
-void CANManager::InitializeNode(uint8_t canBusChannelID, uint8_t nodeID, NodeInfoMsg_t *nodeInfo, CANDriver *driver)
+void CANManager::OnNodeInfo(uint8_t canBusChannelID, uint8_t nodeID, NodeInfoMsg_t *nodeInfo, CANDriver *driver)
 {
-	nodeMapMtx.lock();
-	bool found = nodeMap.find(nodeID) != nodeMap.end();
-	nodeMapMtx.unlock();
-	if (found)
+	std::lock_guard<std::mutex> lock(nodeMapMtx);
+	auto it = nodeInventory.find(nodeID);
+	if (it != nodeInventory.end())
+	{
+		if (std::memcmp(&it->second.nodeInfo, nodeInfo, sizeof(NodeInfoMsg_t)) != 0)
+		{
+			Debug::error("Node %d answered with firmware version 0x%08x and channel mask 0x%08x, which differ from the node inventory, restart to initialize it again",
+			             nodeID, nodeInfo->firmware_version, nodeInfo->channel_mask);
+			it->second.nodeInfo = *nodeInfo;
+			SaveNodeInventory();
+		}
+		return;
+	}
+	if (discoveryClosed)
 	{
-		Debug::print("Node already initialized, ignoring node info msg...");
+		Debug::warning("Node %d answered after the node discovery closed, it is not initialized, consider raising node_discovery_timeout", nodeID);
 		return;
 	}
+	auto expected = expectedNodes.find(nodeID);
+	if (expected != expectedNodes.end() && std::memcmp(&expected->second.nodeInfo, nodeInfo, sizeof(NodeInfoMsg_t)) != 0)
+	{
+		Debug::warning("Node %d changed since the node inventory, initializing it with firmware version 0x%08x and channel mask 0x%08x",
+		               nodeID, nodeInfo->firmware_version, nodeInfo->channel_mask);
+	}
 
-	CANMappingObj nodeMappingObj = mapping->GetNodeObj(nodeID);
+	nodeInventory[nodeID] = {canBusChannelID, nodeID, *nodeInfo, driver};
+	pendingNodeIDs.push_back(nodeID);
+	nodeDiscoveredCV.notify_all();
+}
 
-	std::map<uint8_t, std::tuple<std::string, std::vector<double>>> nodeChannelInfo;
-	for (uint8_t channelID = 0; channelID < 32; channelID++)
+std::vector<CANManager::DiscoveredNode_t> CANManager::TakePendingNodes()
+{
+	std::vector<DiscoveredNode_t> nodes;
+	nodes.reserve(pendingNodeIDs.size());
+	for (uint8_t nodeID : pendingNodeIDs)
 	{
-		uint32_t mask = 0x00000001 & (nodeInfo->channel_mask >> channelID);
-		if (mask == 1)
+		nodes.push_back(nodeInventory[nodeID]);
+	}
+	pendingNodeIDs.clear();
+	return nodes;
+}
+
+void CANManager::InitializeNodes(std::vector<DiscoveredNode_t> nodes)
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	//the mapping is read here, during construction the nodes only register their states, which is thread safe
+	std::vector<std::future<Node *>> constructions(nodes.size());
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		DiscoveredNode_t &discovered = nodes[i];
+		std::string nodeName;
+		std::map<uint8_t, std::tuple<std::string, std::vector<double>>> nodeChannelInfo;
+		try
+		{
+			nodeName = mapping->GetNodeObj(discovered.nodeID).stringID;
+			for (uint8_t channelID = 0; channelID < 32; channelID++)
+			{
+				if ((discovered.nodeInfo.channel_mask >> channelID) & 1)
+				{
+					CANMappingObj channelMappingObj = mapping->GetChannelObj(discovered.nodeID, channelID);
+					nodeChannelInfo[channelID] = {channelMappingObj.stringID, {channelMappingObj.slope, channelMappingObj.offset}};
+				}
+			}
+		}
+		catch (std::exception &e)
 		{
-			CANMappingObj channelMappingObj = mapping->GetChannelObj(nodeID, channelID);
-			nodeChannelInfo[channelID] = {channelMappingObj.stringID, {channelMappingObj.slope, channelMappingObj.offset}};
+			Debug::error("CANManager - InitializeNodes: node %d: %s", discovered.nodeID, e.what());
+			continue;
+		}
 
-			//add sensor names and scaling to array for fast sensor processing
-			//uint16_t mergedID = MergeNodeIDAndChannelID(nodeID, channelID);
-			//sensorInfoMap[mergedID] = {channelMappingObj.stringID, {channelMappingObj.slope, channelMappingObj.offset}};
+		constructions[i] = std::async(std::launch::async, [&discovered, nodeName, channelInfo = std::move(nodeChannelInfo)]() mutable {
+			return new Node(discovered.nodeID, nodeName, discovered.nodeInfo, channelInfo, discovered.canBusChannelID, discovered.driver);
+		});
+	}
 
+	EventManager *eventManager = EventManager::Instance();
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		if (!constructions[i].valid())
+		{
+			continue;
 		}
-		else if (mask > 1)
+		Node *node;
+		try
 		{
-			throw std::logic_error("CANManager - OnCANInit: mask conversion of node info failed");
+			node = constructions[i].get();
 		}
+		catch (std::exception &e)
+		{
+			Debug::error("CANManager - InitializeNodes: node %d: %s", nodes[i].nodeID, e.what());
+			continue;
+		}
+
+		nodeMapMtx.lock();
+		nodeMap[node->GetNodeID()] = node;
+		nodeMapMtx.unlock();
+
+		//states are already added to the state controller by the node on construction
+		auto channelTypeMap = node->GetChannelTypeMap();
+		eventManager->AddChannelTypes(channelTypeMap);
+		eventManager->AddCommands(node->GetCommands());
+
+		Debug::print("Node %s with ID %d on CAN Bus %d detected\n\t\t\tfirmware version 0x%08x", node->GetChannelName().c_str(), node->GetNodeID(), nodes[i].canBusChannelID, node->GetFirmwareVersion());
 	}
+	eventManager->AddCommands({
+		{"Tare", {std::bind(&CANManager::ResetOffset, this, std::placeholders::_1, std::placeholders::_2),{"NodeID","ChannelID","Current Sensor Value"}}},
+		{"FlushDatabase", {std::bind(&CANManager::FlushDatabase, this, std::placeholders::_1, std::placeholders::_2),{}}},
+		{"PrintCANStats", {std::bind(&CANManager::PrintCANStats, this, std::placeholders::_1, std::placeholders::_2),{}}},
+	});
+}
 
-	Node *node = new Node(nodeID, nodeMappingObj.stringID, *nodeInfo, nodeChannelInfo, canBusChannelID, driver);
-	nodeMapMtx.lock();
-	nodeMap[nodeID] = node;
-	nodeMapMtx.unlock();
+bool CANManager::LoadNodeInventory(uint32_t nodeCount)
+{
+	if (nodeInventoryPath.empty())
+	{
+		return false;
+	}
+	std::ifstream inventoryFile(nodeInventoryPath);
+	if (!inventoryFile.is_open())
+	{
+		Debug::print("No node inventory found at %s, discovering nodes...", nodeInventoryPath.c_str());
+		return false;
+	}
 
-	//add states to state controller
-	auto states = node->GetStates();
-	StateController *stateController = StateController::Instance();
-	stateController->AddUninitializedStates(states);
+	std::map<uint8_t, DiscoveredNode_t> inventory;
+	try
+	{
+		nlohmann::json inventoryJson = nlohmann::json::parse(inventoryFile);
+		for (auto &nodeJson : inventoryJson["nodes"])
+		{
+			DiscoveredNode_t node = {0};
+			node.nodeID = nodeJson["node_id"];
+			node.canBusChannelID = nodeJson["can_bus_channel_id"];
+			node.driver = nodeJson["lora"] ? loraDriver : canDriver;
+			node.nodeInfo.firmware_version = nodeJson["firmware_version"];
+			node.nodeInfo.channel_mask = nodeJson["channel_mask"];
+			std::vector<uint8_t> channelTypes = nodeJson["channel_types"];
+			if (node.driver == nullptr || channelTypes.size() != sizeof(node.nodeInfo.channel_type))
+			{
+				Debug::warning("Node inventory %s doesn't match the configuration, discovering nodes...", nodeInventoryPath.c_str());
+				return false;
+			}
+			std::copy(channelTypes.begin(), channelTypes.end(), node.nodeInfo.channel_type);
+			inventory[node.nodeID] = node;
+		}
+	}
+	catch (std::exception &e)
+	{
+		Debug::warning("Node inventory %s invalid, discovering nodes...: %s", nodeInventoryPath.c_str(), e.what());
+		return false;
+	}
+	if (inventory.empty() || inventory.size() < nodeCount)
+	{
+		Debug::print("Node inventory %s incomplete, discovering nodes...", nodeInventoryPath.c_str());
+		return false;
+	}
 
-	//add available commands to event manager
-	EventManager *eventManager = EventManager::Instance();
-	auto channelTypeMap = node->GetChannelTypeMap();
-	eventManager->AddChannelTypes(channelTypeMap);
-	eventManager->AddCommands(node->GetCommands());
-	eventManager->AddCommands({{"Tare", {std::bind(&CANManager::ResetOffset, this, std::placeholders::_1, std::placeholders::_2),{"NodeID","ChannelID","Current Sensor Value"}}}});
-	eventManager->AddCommands({{"FlushDatabase", {std::bind(&CANManager::FlushDatabase, this, std::placeholders::_1, std::placeholders::_2),{}}}});
+	std::lock_guard<std::mutex> lock(nodeMapMtx);
+	expectedNodes = std::move(inventory);
+	return true;
+}
+
+void CANManager::SaveNodeInventory()
+{
+	if (nodeInventoryPath.empty())
+	{
+		return;
+	}
+	nlohmann::json nodes = nlohmann::json::array();
+	for (auto &[nodeID, node] : nodeInventory)
+	{
+		nodes.push_back({
+			{"node_id", node.nodeID},
+			{"can_bus_channel_id", node.canBusChannelID},
+			{"lora", node.driver != nullptr && node.driver == loraDriver},
+			{"firmware_version", (uint32_t) node.nodeInfo.firmware_version},
+			{"channel_mask", (uint32_t) node.nodeInfo.channel_mask},
+			{"channel_types", std::vector<uint8_t>(std::begin(node.nodeInfo.channel_type), std::end(node.nodeInfo.channel_type))},
+		});
+	}
 
-	Debug::print("Node %s with ID %d on CAN Bus %d detected\n\t\t\tfirmware version 0x%08x", node->GetChannelName().c_str(), node->GetNodeID(), canBusChannelID, node->GetFirmwareVersion());
+	std::ofstream inventoryFile(nodeInventoryPath);
+	if (!inventoryFile.is_open())
+	{
+		Debug::warning("CANManager - SaveNodeInventory: can't write %s", nodeInventoryPath.c_str());
+		return;
+	}
+	inventoryFile << nlohmann::json({{"nodes", nodes}}).dump(4);
 }
 
 /**
@@ -315,13 +614,9 @@ void CANManager::InitializeNode(uint8_t canBusChannelID, uint8_t nodeID, NodeInf
 std::map<std::string, std::tuple<double, uint64_t>> CANManager::GetLatestSensorData()
 {
     std::map<std::string, std::tuple<double, uint64_t>> latestSensorDataMap;
-    std::map<std::string, std::tuple<double, uint64_t>> currentMap;
-    Node *currNode;
     for (auto &it : nodeMap)
     {
-        currNode = it.second;
-        currentMap = currNode->GetLatestSensorData();
-        latestSensorDataMap.insert(currentMap.begin(), currentMap.end());
+        it.second->GetLatestSensorData(latestSensorDataMap);
     }
     return latestSensorDataMap;
 }
@@ -332,8 +627,25 @@ void CANManager::OnChannelStateChanged(std::string stateName, double value, uint
     stateController->SetState(std::move(stateName), value, timestamp);
 }
 
+void CANManager::OnCANRecvBatch(std::span<CANFrame_t> frames, CANDriver *canDriver)
+{
+	for (CANFrame_t &frame : frames)
+	{
+		try
+		{
+			OnCANRecv(frame.canBusChannelID, frame.canID, frame.payload, frame.payloadLength, frame.timestamp, canDriver);
+		}
+		catch (const std::exception &e)
+		{
+			Debug::error("CANManager::OnCANRecvBatch error: %s", e.what());
+		}
+	}
+}
+
 void CANManager::OnCANRecv(uint8_t canBusChannelID, uint32_t canID, uint8_t *payload, uint32_t payloadLength, uint64_t timestamp, CANDriver *canDriver)
 {
+	recorder->Record(canBusChannelID, canID, payload, payloadLength, timestamp, canDriver == loraDriver ? CANRecord::FLAG_LORA : 0);
+
 	if(!initialized) // TODO consolidate code from the two initialized/!initialized cases
 	{
 		//TODO: only accept node info messages in this stage
@@ -347,7 +659,7 @@ void CANManager::OnCANRecv(uint8_t canBusChannelID, uint32_t canID, uint8_t *pay
 
 				NodeInfoMsg_t *nodeInfo = (NodeInfoMsg_t *) &canMsg->bit.data.uint8;
 
-				InitializeNode(canBusChannelID, nodeID, nodeInfo, canDriver);
+				OnNodeInfo(canBusChannelID, nodeID, nodeInfo, canDriver);
 
 				if(useLora)
 				{
@@ -358,7 +670,7 @@ void CANManager::OnCANRecv(uint8_t canBusChannelID, uint32_t canID, uint8_t *pay
 					{
 						uint8_t loraNodeID = nodeIDsInt[foundIt - nodeIDsRefInt.begin()];
 						Debug::print("Found lora equivalent with nodeID %d; can bus nodeID %d", loraNodeID, nodeID);
-						InitializeNode(0, loraNodeID, nodeInfo, loraDriver);
+						OnNodeInfo(0, loraNodeID, nodeInfo, loraDriver);
 					}
 				}
 				
@@ -408,27 +720,41 @@ void CANManager::OnCANRecv(uint8_t canBusChannelID, uint32_t canID, uint8_t *pay
 				return;
 				//throw std::runtime_error("Direction bit master to node, ignoring msg...");
 			}
+			if (canMsg->bit.info.channel_id == GENERIC_CHANNEL_ID && canMsg->bit.cmd_id == GENERIC_RES_NODE_INFO && payloadLength > 0)
+			{
+				//answers to the node info request, checked against the node inventory
+				OnNodeInfo(canBusChannelID, nodeID, (NodeInfoMsg_t *) &canMsg->bit.data.uint8, canDriver);
+				return;
+			}
 			//Don't require mutex at this point, since it is read only after initialization
-			bool found = nodeMap.find(nodeID) != nodeMap.end();
-			if (!found)
+			//bad frames are counted instead of thrown, a misbehaving node can send thousands per second
+			Node *node = nodeTable[nodeID];
+			CANRejectReason reason = CANRejectReason::NONE;
+			if (node == nullptr)
 			{
-				throw std::runtime_error("Node: " + std::to_string(nodeID) + " not found, ignoring msg...");
+				reason = CANRejectReason::UNKNOWN_NODE;
 			}
-			Node *node = nodeMap[nodeID];
-			if (payloadLength <= 0)
+			else if (payloadLength <= 0)
 			{
-				throw std::runtime_error("CANManager - OnCANRecv: message with 0 payload not supported");
+				reason = CANRejectReason::EMPTY_PAYLOAD;
 			}
 			//TODO: move logic to node
 			else if (canMsg->bit.info.channel_id == GENERIC_CHANNEL_ID && canMsg->bit.cmd_id == GENERIC_RES_DATA)
 			{
-				//TODO: remove when ringbuffer implemented
-				node->ProcessSensorDataAndWriteToRingBuffer(canMsg, payloadLength, timestamp);
+				reason = node->ProcessSensorDataAndWriteToRingBuffer(canMsg, payloadLength, timestamp);
+			}
+			else if (canMsg->bit.info.channel_id != GENERIC_CHANNEL_ID && !node->HasChannel(canMsg->bit.info.channel_id))
+			{
+				reason = CANRejectReason::UNKNOWN_CHANNEL;
 			}
 			else
 			{
 				node->ProcessCANCommand(canMsg, payloadLength, timestamp);
 			}
+			if (reason != CANRejectReason::NONE)
+			{
+				rejectStats.Reject(reason, canBusChannelID, canID, payload, payloadLength);
+			}
 		}
 		catch (std::runtime_error &e)
 		{
@@ -496,6 +822,15 @@ void CANManager::FlushDatabase(std::vector<double> &params, bool testOnly)
     }
 }
 
+void CANManager::PrintCANStats(std::vector<double> &params, bool testOnly)
+{
+	if (testOnly)
+	{
+		return;
+	}
+	rejectStats.Print();
+}
+
 //std::vector<std::string> CANManager::GetChannelStates()
 //{
 //    if (initialized)
@@ -0,0 +1,329 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "can/CANRecorder.h"
+#include "utility/utils.h"
+#include "utility/Debug.h"
+
+std::string CANRecord::SegmentPath(const std::string &dirPath, uint32_t part)
+{
+    return dirPath + "/can_traffic." + std::to_string(part) + ".canrec";
+}
+
+std::string CANRecord::IndexPath(const std::string &dirPath)
+{
+    return dirPath + "/can_traffic.canidx";
+}
+
+CANRecorder::~CANRecorder()
+{
+    Stop();
+}
+
+void CANRecorder::Init(Config &config)
+{
+    nlohmann::json canConfig = config["/CAN"];
+    if (utils::keyExists(canConfig, "enable_recorder"))
+    {
+        enabled = canConfig["enable_recorder"];
+    }
+    if (utils::keyExists(canConfig, "recorder_segment_size"))
+    {
+        segmentSize = canConfig["recorder_segment_size"];
+        if (segmentSize < CANRecord::SEGMENT_HEADER_SIZE + CANRecord::FrameSize(CANRecord::MAX_PAYLOAD_LENGTH))
+        {
+            throw std::runtime_error("CANRecorder - Init: recorder_segment_size too small");
+        }
+    }
+    if (utils::keyExists(canConfig, "recorder_index_interval"))
+    {
+        indexInterval = canConfig["recorder_index_interval"];
+    }
+
+    if (!enabled)
+    {
+        Debug::print("CAN recorder disabled");
+        return;
+    }
+
+    time_t currTime;
+    char dateTimeString[100];
+    time(&currTime);
+    strftime(dateTimeString, 100, "%Y_%m_%d__%H_%M_%S", localtime(&currTime));
+    Rotate("logs/" + std::string(dateTimeString));
+}
+
+void CANRecorder::Rotate(const std::string &newDirPath)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(segmentMtx);
+    CloseRecording();
+
+    try
+    {
+        std::filesystem::create_directories(newDirPath);
+        dirPath = newDirPath;
+        segment = OpenSegment(0);
+        indexFile = fopen(CANRecord::IndexPath(dirPath).c_str(), "wb");
+        if (indexFile == nullptr)
+        {
+            throw std::runtime_error("couldn't open " + CANRecord::IndexPath(dirPath) + ": " + std::strerror(errno));
+        }
+        nextIndexTimestamp = 0;
+        Debug::print("CAN recorder writing to %s", dirPath.c_str());
+    }
+    catch (const std::exception &e)
+    {
+        // losing the recording must not take down the server
+        CloseRecording();
+        Debug::error("CANRecorder - Rotate: %s, recording stopped", e.what());
+    }
+}
+
+void CANRecorder::Stop()
+{
+    std::unique_lock<std::shared_mutex> lock(segmentMtx);
+    CloseRecording();
+}
+
+/**
+ * NOTE: segmentMtx must be held exclusively
+ */
+void CANRecorder::CloseRecording()
+{
+    if (segment != nullptr)
+    {
+        CloseSegment(segment);
+        segment = nullptr;
+    }
+    std::lock_guard<std::mutex> indexLock(indexMtx);
+    if (indexFile != nullptr)
+    {
+        fclose(indexFile);
+        indexFile = nullptr;
+    }
+}
+
+CANRecorder::Segment_t *CANRecorder::OpenSegment(uint32_t part)
+{
+    std::string path = CANRecord::SegmentPath(dirPath, part);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("couldn't open " + path + ": " + std::strerror(errno));
+    }
+    // sparse, only the pages written to take up space
+    if (ftruncate(fd, segmentSize) < 0)
+    {
+        close(fd);
+        throw std::runtime_error("couldn't resize " + path + ": " + std::strerror(errno));
+    }
+    void *mapped = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close(fd);
+        throw std::runtime_error("couldn't map " + path + ": " + std::strerror(errno));
+    }
+
+    Segment_t *newSegment = new Segment_t();
+    newSegment->fd = fd;
+    newSegment->data = (char *) mapped;
+    newSegment->size = segmentSize;
+    newSegment->part = part;
+    newSegment->writeOffset = CANRecord::SEGMENT_HEADER_SIZE;
+    newSegment->usedBytes = 0;
+
+    CANRecord::SegmentHeader_t *header = (CANRecord::SegmentHeader_t *) newSegment->data;
+    header->magic = CANRecord::SEGMENT_MAGIC;
+    header->version = CANRecord::VERSION;
+    header->part = part;
+    header->created = utils::getCurrentTimestamp();
+
+    return newSegment;
+}
+
+/**
+ * NOTE: segmentMtx must be held exclusively, so every reserved frame is completely written
+ */
+void CANRecorder::CloseSegment(Segment_t *closedSegment)
+{
+    uint64_t writeOffset = closedSegment->writeOffset;
+    std::size_t used = writeOffset <= closedSegment->size ? writeOffset : closedSegment->usedBytes.load();
+
+    munmap(closedSegment->data, closedSegment->size);
+    if (ftruncate(closedSegment->fd, used) < 0)
+    {
+        Debug::warning("CANRecorder: couldn't truncate segment %u: %s", closedSegment->part, std::strerror(errno));
+    }
+    close(closedSegment->fd);
+    delete closedSegment;
+}
+
+void CANRecorder::NextSegment(Segment_t *fullSegment)
+{
+    std::unique_lock<std::shared_mutex> lock(segmentMtx);
+    if (segment != fullSegment)
+    {
+        // another thread already switched
+        return;
+    }
+
+    uint32_t part = fullSegment->part + 1;
+    CloseSegment(fullSegment);
+    segment = nullptr;
+    try
+    {
+        segment = OpenSegment(part);
+    }
+    catch (const std::exception &e)
+    {
+        CloseRecording();
+        Debug::error("CANRecorder - NextSegment: %s, recording stopped", e.what());
+    }
+}
+
+uint64_t CANRecorder::GetRecordedFrames()
+{
+    return recordedFrames;
+}
+
+uint64_t CANRecorder::GetDroppedFrames()
+{
+    return droppedFrames;
+}
+
+CANRecordReader::CANRecordReader(std::string dirPath) : dirPath(std::move(dirPath))
+{
+}
+
+CANRecordReader::~CANRecordReader()
+{
+    ClosePart();
+}
+
+bool CANRecordReader::Open()
+{
+    index.clear();
+    FILE *indexFile = fopen(CANRecord::IndexPath(dirPath).c_str(), "rb");
+    if (indexFile != nullptr)
+    {
+        CANRecord::IndexEntry_t entry;
+        while (fread(&entry, sizeof(entry), 1, indexFile) == 1)
+        {
+            index.push_back(entry);
+        }
+        fclose(indexFile);
+    }
+    return OpenPart(0);
+}
+
+bool CANRecordReader::OpenPart(uint32_t newPart)
+{
+    ClosePart();
+
+    std::string path = CANRecord::SegmentPath(dirPath, newPart);
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    off_t fileSize = lseek(fd, 0, SEEK_END);
+    if (fileSize < (off_t) CANRecord::SEGMENT_HEADER_SIZE)
+    {
+        ClosePart();
+        return false;
+    }
+    void *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        ClosePart();
+        return false;
+    }
+    data = (const char *) mapped;
+    size = fileSize;
+
+    const CANRecord::SegmentHeader_t *header = (const CANRecord::SegmentHeader_t *) data;
+    if (header->magic != CANRecord::SEGMENT_MAGIC || header->version != CANRecord::VERSION)
+    {
+        Debug::warning("CANRecordReader: %s is not a can recording", path.c_str());
+        ClosePart();
+        return false;
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    part = newPart;
+    offset = CANRecord::SEGMENT_HEADER_SIZE;
+    return true;
+}
+
+void CANRecordReader::ClosePart()
+{
+    if (data != nullptr)
+    {
+        munmap((void *) data, size);
+        data = nullptr;
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    size = 0;
+}
+
+void CANRecordReader::Seek(uint64_t timestamp)
+{
+    auto it = std::upper_bound(index.begin(), index.end(), timestamp,
+                               [](uint64_t value, const CANRecord::IndexEntry_t &entry) { return value < entry.timestamp; });
+    if (it == index.begin())
+    {
+        OpenPart(0);
+        return;
+    }
+    --it;
+    if (OpenPart(it->part) && it->offset + sizeof(CANRecord::FrameHeader_t) <= size)
+    {
+        offset = it->offset;
+    }
+}
+
+bool CANRecordReader::Next(CANRecord::Frame_t &frame)
+{
+    while (data != nullptr)
+    {
+        if (offset + sizeof(CANRecord::FrameHeader_t) <= size)
+        {
+            const CANRecord::FrameHeader_t *header = (const CANRecord::FrameHeader_t *) &data[offset];
+            std::size_t frameSize = CANRecord::FrameSize(header->payloadLength);
+            if (header->committed != 0 && header->payloadLength <= CANRecord::MAX_PAYLOAD_LENGTH
+                && offset + frameSize <= size)
+            {
+                frame.timestamp = header->timestamp;
+                frame.canID = header->canID;
+                frame.canBusChannelID = header->canBusChannelID;
+                frame.flags = header->flags;
+                frame.payloadLength = header->payloadLength;
+                std::memcpy(frame.payload, &data[offset + sizeof(CANRecord::FrameHeader_t)], header->payloadLength);
+                offset += frameSize;
+                return true;
+            }
+        }
+        // end of this segment, continue with the next part if there is one
+        if (!OpenPart(part + 1))
+        {
+            return false;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,67 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include "can/CANRejectStats.h"
+
+#include "can_houbolt/cmds.h"
+#include "utility/Debug.h"
+
+void CANRejectStats::LogRejection(CANRejectReason reason, uint8_t canBusChannelID, uint32_t canID, const uint8_t *payload, uint32_t payloadLength, int64_t now)
+{
+    Counter_t &counter = counters[(size_t) reason];
+    int64_t nextLogTime = counter.nextLogTime.load(std::memory_order_relaxed);
+    // only one thread logs per interval
+    if (now < nextLogTime || !counter.nextLogTime.compare_exchange_strong(nextLogTime, now + LOG_INTERVAL, std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    uint64_t count = counter.count.load(std::memory_order_relaxed);
+    uint64_t dropped = count - counter.loggedCount.exchange(count, std::memory_order_relaxed);
+
+    Can_MessageId_t *canIDStruct = (Can_MessageId_t *) &canID;
+    int channelID = -1;
+    int cmdID = -1;
+    if (payloadLength >= 2)
+    {
+        Can_MessageData_t *canMsg = (Can_MessageData_t *) payload;
+        channelID = canMsg->bit.info.channel_id;
+        cmdID = canMsg->bit.cmd_id;
+    }
+    Debug::error("CANManager: %lu frames rejected (%s) since the last report, e.g. node %d, channel %d, cmd %d, length %u on can bus %d",
+                   dropped, GetReasonName(reason), canIDStruct->info.node_id, channelID, cmdID, payloadLength, canBusChannelID);
+}
+
+uint64_t CANRejectStats::GetCount(CANRejectReason reason)
+{
+    return counters[(size_t) reason].count.load(std::memory_order_relaxed);
+}
+
+const char *CANRejectStats::GetReasonName(CANRejectReason reason)
+{
+    switch (reason)
+    {
+        case CANRejectReason::NONE:
+            return "none";
+        case CANRejectReason::UNKNOWN_NODE:
+            return "unknown node";
+        case CANRejectReason::EMPTY_PAYLOAD:
+            return "empty payload";
+        case CANRejectReason::UNKNOWN_CHANNEL:
+            return "unknown channel";
+        case CANRejectReason::INVALID_SENSOR_FRAME:
+            return "invalid sensor frame";
+        default:
+            return "unknown reason";
+    }
+}
+
+void CANRejectStats::Print()
+{
+    Debug::print("Rejected CAN frames:");
+    for (size_t i = 1; i < (size_t) CANRejectReason::COUNT; i++)
+    {
+        Debug::print("\t%s: %lu", GetReasonName((CANRejectReason) i), GetCount((CANRejectReason) i));
+    }
+}
@@ -0,0 +1,126 @@
+#include "can/CANTransmitQueue.h"
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "utility/Debug.h"
+
+thread_local TxPriority CANTransmitQueue::currentPriority = TxPriority::NORMAL;
+
+CANTransmitQueue::CANTransmitQueue(const std::vector<uint32_t> &canBusChannelIDs, SendFunction send, size_t maxQueued, size_t maxBatch) :
+	send(std::move(send)), maxQueued(maxQueued), maxBatch(std::max<size_t>(maxBatch, 1))
+{
+	for (uint32_t canBusChannelID : canBusChannelIDs)
+	{
+		if (canBusChannelID >= buses.size())
+		{
+			buses.resize(canBusChannelID + 1);
+		}
+		if (buses[canBusChannelID] != nullptr)
+		{
+			continue;
+		}
+		buses[canBusChannelID] = std::make_unique<BusQueue_t>();
+		buses[canBusChannelID]->canBusChannelID = canBusChannelID;
+	}
+	for (auto &bus : buses)
+	{
+		if (bus != nullptr)
+		{
+			bus->thread = std::thread(&CANTransmitQueue::transmitLoop, this, bus.get());
+		}
+	}
+}
+
+CANTransmitQueue::~CANTransmitQueue()
+{
+	stopping = true;
+	for (auto &bus : buses)
+	{
+		if (bus != nullptr)
+		{
+			{
+				std::lock_guard<std::mutex> lock(bus->mtx);
+			}
+			bus->cv.notify_one();
+			if (bus->thread.joinable()) bus->thread.join();
+		}
+	}
+}
+
+void CANTransmitQueue::Push(uint32_t canBusChannelID, uint32_t canID, const uint8_t *payload, uint32_t payloadLength, bool blocking)
+{
+	if (canBusChannelID >= buses.size() || buses[canBusChannelID] == nullptr)
+	{
+		throw std::runtime_error("CANTransmitQueue - Push: no transmit queue for can bus " + std::to_string(canBusChannelID));
+	}
+	if (payloadLength > sizeof(TxFrame_t::payload))
+	{
+		throw std::runtime_error("CANTransmitQueue - Push: payload length " + std::to_string(payloadLength) + " too long");
+	}
+
+	BusQueue_t *bus = buses[canBusChannelID].get();
+	bool wasEmpty;
+	{
+		std::lock_guard<std::mutex> lock(bus->mtx);
+		std::deque<TxFrame_t> &queue = bus->queues[(uint8_t) currentPriority];
+		// urgent frames are never rejected, an abort has to get out even if normal frames are backed up
+		if (currentPriority != TxPriority::URGENT && bus->queues[0].size() + bus->queues[1].size() >= maxQueued)
+		{
+			throw std::runtime_error("CANTransmitQueue - Push: transmit queue of can bus " + std::to_string(canBusChannelID) + " full");
+		}
+		wasEmpty = bus->queues[0].empty() && bus->queues[1].empty();
+		TxFrame_t &frame = queue.emplace_back();
+		frame.canID = canID;
+		frame.payloadLength = payloadLength;
+		frame.blocking = blocking;
+		std::memcpy(frame.payload, payload, payloadLength);
+	}
+	// the transmit thread only sleeps while the queue is empty
+	if (wasEmpty)
+	{
+		bus->cv.notify_one();
+	}
+}
+
+void CANTransmitQueue::transmitLoop(BusQueue_t *bus)
+{
+	std::vector<TxFrame_t> batch;
+	batch.reserve(maxBatch);
+	while (true)
+	{
+		batch.clear();
+		{
+			std::unique_lock<std::mutex> lock(bus->mtx);
+			bus->cv.wait(lock, [this, bus] { return !bus->queues[0].empty() || !bus->queues[1].empty() || stopping; });
+			if (bus->queues[0].empty() && bus->queues[1].empty())
+			{
+				break;
+			}
+			// everything queued since the last batch, urgent frames first
+			for (std::deque<TxFrame_t> &queue : bus->queues)
+			{
+				while (!queue.empty() && batch.size() < maxBatch)
+				{
+					batch.push_back(queue.front());
+					queue.pop_front();
+				}
+			}
+		}
+
+		try
+		{
+			send(bus->canBusChannelID, std::span<TxFrame_t>(batch));
+		}
+		catch (const std::exception &e)
+		{
+			failedFrames += batch.size();
+			Debug::error("CANTransmitQueue: sending %zu frames on can bus %u failed: %s", batch.size(), bus->canBusChannelID, e.what());
+		}
+	}
+}
+
+uint64_t CANTransmitQueue::GetFailedFrames()
+{
+	return failedFrames;
+}
@@ -10,6 +10,7 @@
 
 const std::vector<std::string> Channel::states = {};
 const std::map<std::string, std::vector<double>> Channel::sensorScalingMap = {};
+std::atomic_uint64_t Channel::scalingGeneration = 0;
 
 //---------------------------------------------------------------------------------------//
 //-------------------------------GETTER & SETTER Functions-------------------------------//
@@ -40,6 +41,33 @@ std::vector<std::string> Channel::GetStates()
     return states;
 };
 
+void Channel::RegisterStates()
+{
+    std::vector<std::string> states = GetStates();
+    InitStateIDs(states);
+}
+
+/**
+ * registers the given prefixed states as uninitialized states and maps their names without prefix to the state ids
+ * @param states state names including the channel prefix
+ */
+void Channel::InitStateIDs(const std::vector<std::string> &states)
+{
+    std::vector<std::string> stateNames = states;
+    std::vector<state_id_t> stateIDs = StateController::Instance()->AddUninitializedStates(stateNames);
+
+    std::string prefix = GetStatePrefix();
+    for (size_t i = 0; i < stateNames.size(); i++)
+    {
+        std::string stateName = stateNames[i];
+        if (stateName.rfind(prefix, 0) == 0)
+        {
+            stateName.erase(0, prefix.length());
+        }
+        stateIDMap[stateName] = stateIDs[i];
+    }
+}
+
 std::map<std::string, command_t> Channel::GetCommands()
 {
     std::map<std::string, command_t> commandsTmp;
@@ -226,6 +254,7 @@ std::vector<double> Channel::ResetSensorOffset(std::vector<double> &params, bool
         double currValue = params[0];
         scalingMtx.lock();
         sensorScaling[1] = sensorScaling[1] - currValue;
+        scalingGeneration++;
         scalingMtx.unlock();
 
 		return sensorScaling;
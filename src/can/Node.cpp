@@ -2,10 +2,13 @@
 
 #include <map>
 #include <cstring>
+#include <algorithm>
 #include <string>
 #include <functional>
+#include <mutex>
 #include <utility>
 #include "utility/Config.h"
+#include "utility/utils.h"
 #include "can/DigitalOut.h"
 #include "can/ADC16.h"
 #include "can/ADC16Single.h"
@@ -68,13 +71,15 @@ const std::map<GENERIC_VARIABLES, std::string> Node::variableMap =
 
 InfluxDbLogger *Node::logger = nullptr;
 bool Node::enableFastLogging;
+bool Node::enableWideRowLogging = false;
 std::string Node::influxIP;
 int Node::influxPort;
 std::string Node::databaseName;
 std::string Node::measurementName;
 int Node::influxBufferSize;
+uint64_t Node::sensorRingBufferSize = 4096;
 
-std::mutex Node::loggerMtx;
+InfluxDbWriterOptions Node::influxOptions;
 
 /**
  * consider putting event mapping into llinterface
@@ -84,10 +89,12 @@ std::mutex Node::loggerMtx;
  */
 
 Node::Node(uint8_t nodeID, std::string nodeChannelName, NodeInfoMsg_t& nodeInfo, std::map<uint8_t, std::tuple<std::string, std::vector<double>>> &channelInfo, uint8_t canBusChannelID, CANDriver *driver)
-    : Channel::Channel("Generic", 0xFF, std::move(nodeChannelName), {1.0, 0.0}, this), canBusChannelID(canBusChannelID), nodeID(nodeID), firwareVersion(nodeInfo.firmware_version), driver(driver)
+    : Channel::Channel("Generic", 0xFF, std::move(nodeChannelName), {1.0, 0.0}, this), canBusChannelID(canBusChannelID), nodeID(nodeID), firwareVersion(nodeInfo.firmware_version), driver(driver), sensorRing(sensorRingBufferSize)
 {
 
-    if (logger == nullptr)
+    //nodes are constructed in parallel during discovery, the first one creates the logger
+    static std::once_flag loggerInitFlag;
+    std::call_once(loggerInitFlag, []()
     {
         Debug::info("%d, %s, %d, %s, %s, %d", enableFastLogging, influxIP.c_str(), influxPort, databaseName.c_str(), measurementName.c_str(), influxBufferSize);
 #ifndef NO_INFLUX
@@ -99,7 +106,8 @@ Node::Node(uint8_t nodeID, std::string nodeChannelName, NodeInfoMsg_t& nodeInfo,
                         influxPort,
                         databaseName,
                         measurementName, MICROSECONDS,
-                        influxBufferSize);
+                        influxBufferSize,
+                        influxOptions);
         }
         else
         {
@@ -109,7 +117,7 @@ Node::Node(uint8_t nodeID, std::string nodeChannelName, NodeInfoMsg_t& nodeInfo,
         }
 #endif
 
-    }
+    });
 
     commandMap = {
         {"SetBus1Voltage", {std::bind(&Node::SetBus1Voltage, this, std::placeholders::_1, std::placeholders::_2),{"Value"}}},
@@ -138,9 +146,33 @@ Node::Node(uint8_t nodeID, std::string nodeChannelName, NodeInfoMsg_t& nodeInfo,
     };
 
     InitChannels(nodeInfo, channelInfo);
-    //init latest sensor buffer with largest channel id
-    latestSensorBufferLength = channelMap.rbegin()->first + 1;
-    latestSensorBuffer = new SensorData_t[latestSensorBufferLength]{{0}};
+    RegisterStates();
+    CANRejectReason planResult = decodePlan.Build(nodeInfo.channel_mask, channelMap, Channel::GetScalingGeneration());
+    if (planResult != CANRejectReason::NONE)
+    {
+        //sensor frames with this mask are rejected and counted
+        Debug::warning("Node %s: can't decode sensor frames of channel mask 0x%08x, %s", GetChannelName().c_str(),
+                       nodeInfo.channel_mask, CANRejectStats::GetReasonName(planResult));
+    }
+
+#ifndef NO_INFLUX
+    if (logger != nullptr)
+    {
+        nodeSeriesKey = logger->createSeriesKey("node", GetChannelName());
+    }
+#endif
+    sensorNames.reserve(channelMap.size());
+    for (auto &channel : channelMap)
+    {
+        sensorNames.emplace_back(channel.first, channel.second->GetSensorName());
+#ifndef NO_INFLUX
+        if (logger != nullptr)
+        {
+            sensorSeriesKeys[channel.first] = logger->createSeriesKey(channel.second->GetSensorName());
+            sensorFieldKeys[channel.first] = logger->createFieldKey(channel.second->GetSensorName());
+        }
+#endif
+    }
 }
 
 void Node::InitConfig(Config &config) {
@@ -150,6 +182,19 @@ void Node::InitConfig(Config &config) {
     databaseName = config["/INFLUXDB/database_name"];
     measurementName = config["/INFLUXDB/fast_sensor_measurement"];
     influxBufferSize = config["/INFLUXDB/fast_sensor_buffer_size"];
+    influxOptions = InfluxDbLogger::ReadOptions(config["/INFLUXDB"]);
+
+    nlohmann::json influxConfig = config["/INFLUXDB"];
+    if (utils::keyExists(influxConfig, "fast_sensor_wide_rows"))
+    {
+        enableWideRowLogging = influxConfig["fast_sensor_wide_rows"];
+    }
+
+    nlohmann::json canConfig = config["/CAN"];
+    if (utils::keyExists(canConfig, "sensor_ring_buffer_size"))
+    {
+        sensorRingBufferSize = canConfig["sensor_ring_buffer_size"];
+    }
 }
 
 /**
@@ -209,6 +254,7 @@ void Node::InitChannels(NodeInfoMsg_t &nodeInfo, std::map<uint8_t, std::tuple<st
             }
 
             channelMap[channelID] = ch;
+            channelTable[channelID] = ch;
             indexCounter++;
         }
         else if (mask > 1)
@@ -227,29 +273,55 @@ Node::~Node()
 //-------------------------------GETTER & SETTER Functions-------------------------------//
 //---------------------------------------------------------------------------------------//
 
-std::map<std::string, std::tuple<double, uint64_t>> Node::GetLatestSensorData()
+std::span<ChannelSensorData_t> Node::GetLatestSensorData(std::span<ChannelSensorData_t> buffer)
 {
-    std::map<std::string, std::tuple<double, uint64_t>> sensorData;
-    SensorData_t *copy = new SensorData_t[latestSensorBufferLength];
-    size_t bytes = latestSensorBufferLength * sizeof(SensorData_t);
-
-    bufferMtx.lock();
-    std::memcpy(copy, latestSensorBuffer, bytes);
-    bufferMtx.unlock();
-
-    for (size_t i = 0; i < latestSensorBufferLength; i++)
+    size_t length = std::min(buffer.size(), sensorNames.size());
+    for (size_t i = 0; i < length; i++)
     {
-        if (channelMap.find(i) != channelMap.end())
-        {
+        uint8_t channelID = sensorNames[i].first;
+        buffer[i].channelID = channelID;
+        latestSensorSlots[channelID].Read(buffer[i].value, buffer[i].timestamp);
+    }
+    return buffer.first(length);
+}
 
-            sensorData[channelMap[i]->GetSensorName()] = {copy[i].value, copy[i].timestamp};
-        }
+/**
+ * adds the latest value of every channel to the given map, keyed by sensor name
+ * @param sensorData
+ */
+void Node::GetLatestSensorData(std::map<std::string, std::tuple<double, uint64_t>> &sensorData)
+{
+    std::array<ChannelSensorData_t, 32> buffer;
+    std::span<ChannelSensorData_t> latest = GetLatestSensorData(buffer);
 
+    for (size_t i = 0; i < latest.size(); i++)
+    {
+        sensorData[sensorNames[i].second] = {latest[i].value, latest[i].timestamp};
     }
     /* if (nodeID==8)
     Debug::print("NodeID %d, %zd sensor data transmissions", nodeID, uint64_t(count));*/
     count = 0;
-    return sensorData;
+}
+
+/**
+ * @param channelID
+ * @return sensor name of the channel as cached on construction
+ */
+const std::string &Node::GetChannelSensorName(uint8_t channelID)
+{
+    for (auto &sensorName : sensorNames)
+    {
+        if (sensorName.first == channelID)
+        {
+            return sensorName.second;
+        }
+    }
+    throw std::runtime_error("Node - GetChannelSensorName: channel " + std::to_string(channelID) + " not found");
+}
+
+const SensorRingBuffer *Node::GetSensorRingBuffer()
+{
+    return &sensorRing;
 }
 
 //TODO: add node name and channel names as prefix
@@ -277,6 +349,26 @@ std::vector<std::string> Node::GetStates()
     return states;
 }
 
+/**
+ * registers the node states and the states of all channels, so state changes on the
+ * receive path are addressed by state id instead of by name
+ */
+void Node::RegisterStates()
+{
+    std::vector<std::string> nodeStates(Node::states.begin(), Node::states.end());
+    std::string prefix = GetStatePrefix();
+    for (auto &state : nodeStates)
+    {
+        state.insert(0, prefix);
+    }
+    InitStateIDs(nodeStates);
+
+    for (auto &channel : channelMap)
+    {
+        channel.second->RegisterStates();
+    }
+}
+
 std::map<std::string, std::string> Node::GetChannelTypeMap()
 {
     std::map<std::string, std::string> channelTypeMap;
@@ -341,74 +433,89 @@ uint8_t Node::GetCANBusChannelID()
 
 //TODO: adapt to CanMessageData_t type
 //TODO: add buffer writing
-void Node::ProcessSensorDataAndWriteToRingBuffer(Can_MessageData_t *canMsg, uint32_t &canMsgLength,
-                                                 uint64_t &timestamp)
+CANRejectReason Node::ProcessSensorDataAndWriteToRingBuffer(Can_MessageData_t *canMsg, uint32_t &canMsgLength,
+                                                            uint64_t &timestamp)
 {
-    //TODO: make this more efficient
-    if (canMsgLength < 2)
+    constexpr uint32_t SENSOR_HEADER_SIZE = 2 + sizeof(SensorMsg_t::channel_mask);
+    if (canMsgLength < SENSOR_HEADER_SIZE || canMsg->bit.info.channel_id != GENERIC_CHANNEL_ID || canMsg->bit.cmd_id != GENERIC_RES_DATA)
     {
-        throw std::runtime_error("Node - ProcessSensorDataAndWriteToRingBuffer: payload length is smaller than 2, invalid can msg");
+        return CANRejectReason::INVALID_SENSOR_FRAME;
     }
-    if (canMsg->bit.info.channel_id != GENERIC_CHANNEL_ID || canMsg->bit.cmd_id != GENERIC_RES_DATA)
-    {
-        throw std::runtime_error("Node - ProcessSensorDataAndWriteToRingBuffer: not a sensor data message, ignored...");
-    }
-    count++;
 
     SensorMsg_t *sensorMsg = (SensorMsg_t *) canMsg->bit.data.uint8;
-    uint8_t *valuePtr = sensorMsg->channel_data;
-    uint8_t currValueLength = 0;
-    double currValue = 0;
-    for (uint8_t channelID = 0; channelID < 32; channelID++)
+    uint64_t scalingGeneration = Channel::GetScalingGeneration();
+    if (!decodePlan.Matches(sensorMsg->channel_mask, scalingGeneration))
     {
-        uint32_t mask = 0x00000001 & (sensorMsg->channel_mask >> channelID);
-        if (mask == 1)
+        //a mask that already failed isn't planned again until a scaling changes
+        CANRejectReason reason = decodePlan.GetRejectReason(sensorMsg->channel_mask, scalingGeneration);
+        if (reason == CANRejectReason::NONE)
         {
-            Channel *ch;
-            try
-            {
-                if (channelMap.find(channelID) == channelMap.end())
-                {
-                    throw std::runtime_error("Node - ProcessSensorDataAndWriteToRingBuffer: Channel not found");
-                }
-                ch = channelMap[channelID];
+            reason = decodePlan.Build(sensorMsg->channel_mask, channelMap, scalingGeneration);
+        }
+        if (reason != CANRejectReason::NONE)
+        {
+            return reason;
+        }
+    }
+    //a truncated frame would be decoded from the stale bytes of the receive buffer
+    if (canMsgLength < SENSOR_HEADER_SIZE + decodePlan.GetDataLength())
+    {
+        return CANRejectReason::INVALID_SENSOR_FRAME;
+    }
+    count++;
 
-                ch->GetSensorValue(valuePtr, currValueLength, currValue);
-                // Debug::print("Hello chid %d, value %f", channelID, currValue);
-                if (currValueLength <= 0)
-                {
-                    throw std::logic_error("Node - ProcessSensorDataAndWriteToRingBuffer: value length from channel is 0");
-                }
+    std::array<double, SensorDecodePlan::MAX_CHANNELS> values;
+    std::span<double> decoded = decodePlan.Decode(sensorMsg->channel_data, values);
 
-                {
-                    std::lock_guard<std::mutex> lock(bufferMtx);
+    //logging happens on the sensor log thread of the CANManager, which reads the ring
+    for (size_t i = 0; i < decoded.size(); i++)
+    {
+        uint8_t channelID = decodePlan.GetChannelID(i);
+        double currValue = decoded[i];
 
-                    latestSensorBuffer[channelID] = {currValue, timestamp};
+        latestSensorSlots[channelID].Write(currValue, timestamp);
+        sensorRing.Push(channelID, currValue, timestamp);
+    }
+    return CANRejectReason::NONE;
+}
 
+size_t Node::LogSensorSamples(SensorRingReader &reader, std::span<ChannelSensorData_t> buffer)
+{
+    std::span<ChannelSensorData_t> samples = reader.Read(buffer);
 #ifndef NO_INFLUX
-                    if (enableFastLogging)
-                    {
-                        std::lock_guard<std::mutex> lock(loggerMtx);
-                        logger->log(ch->GetSensorName(), currValue, timestamp);
-                        //logger->flush();
-                    }
-#endif
-                    //buffer.push_back(sensor); //TODO: uncomment if implemented
-                }
-
-                valuePtr += currValueLength;
-            }
-            catch (std::exception &e)
-            {
-                throw std::runtime_error("Node - ProcessSensorDataAndWriteToRingBuffer: " + std::string(e.what()));
-            }
-
+    if (logger == nullptr)
+    {
+        return samples.size();
+    }
+    if (!enableWideRowLogging)
+    {
+        for (ChannelSensorData_t &sample : samples)
+        {
+            //formats into the current buffer only, sending happens on the writer thread of the logger
+            logger->logSeries(sensorSeriesKeys[sample.channelID], sample.value, sample.timestamp);
         }
-        else if (mask > 1)
+        return samples.size();
+    }
+
+    //the samples of a frame are consecutive with the same timestamp and ascending channel ids, a frame split
+    //by the end of the buffer gives two rows with the same timestamp, which influx merges
+    std::array<const std::string *, 32> rowFieldKeys;
+    std::array<double, 32> rowValues;
+    size_t rowLength = 0;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        rowFieldKeys[rowLength] = &sensorFieldKeys[samples[i].channelID];
+        rowValues[rowLength++] = samples[i].value;
+        if (i + 1 == samples.size() || samples[i + 1].timestamp != samples[i].timestamp
+            || samples[i + 1].channelID <= samples[i].channelID)
         {
-            throw std::logic_error("CANManager - OnCANInit: mask convertion of node info failed");
+            logger->logSeries(nodeSeriesKey, std::span<const std::string *>(rowFieldKeys.data(), rowLength),
+                              std::span<const double>(rowValues.data(), rowLength), samples[i].timestamp);
+            rowLength = 0;
         }
     }
+#endif
+    return samples.size();
 }
 
 void Node::ProcessCANCommand(Can_MessageData_t *canMsg, uint32_t &canMsgLength, uint64_t &timestamp)
@@ -417,11 +524,12 @@ void Node::ProcessCANCommand(Can_MessageData_t *canMsg, uint32_t &canMsgLength,
     {
         if (canMsg->bit.info.channel_id != GENERIC_CHANNEL_ID)
         {
-            if (channelMap.find(canMsg->bit.info.channel_id) == channelMap.end())
+            uint8_t channelID = canMsg->bit.info.channel_id;
+            Channel *channel = channelID < channelTable.size() ? channelTable[channelID] : nullptr;
+            if (channel == nullptr)
             {
-                throw std::runtime_error("Node - ProcessSensorDataAndWriteToRingBuffer: Channel not found");
+                throw std::runtime_error("Node - ProcessCANCommand: Channel not found");
             }
-            Channel *channel = channelMap[canMsg->bit.info.channel_id];
             channel->ProcessCANCommand(canMsg, canMsgLength, timestamp);
         }
         else
@@ -798,6 +906,11 @@ void Node::RequestResetAllSettings(std::vector<double> &params, bool testOnly)
 //-----------------------------Utility Functions------------------------------//
 //----------------------------------------------------------------------------//
 
+bool Node::IsFastLoggingEnabled()
+{
+    return logger != nullptr;
+}
+
 void Node::FlushLogger()
 {
     if (logger != nullptr)
@@ -817,11 +930,11 @@ std::vector<double> Node::ResetSensorOffset(std::vector<double> &params, bool te
         uint8_t channelID = params[0];
         params.erase(params.begin());
 
-        if (channelMap.find(channelID) == channelMap.end())
+        Channel *channel = channelID < channelTable.size() ? channelTable[channelID] : nullptr;
+        if (channel == nullptr)
         {
             throw std::runtime_error("Node - ResetSensorOffset: Channel not found");
         }
-        Channel *channel = channelMap[channelID];
         return channel->ResetSensorOffset(params, testOnly);
         
 
@@ -0,0 +1,68 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include "can/SensorDecodePlan.h"
+
+#include "can/Channel.h"
+#include "can/Node.h"
+
+CANRejectReason SensorDecodePlan::Reject(uint32_t mask, uint64_t generation, CANRejectReason reason)
+{
+    rejectedMask = mask;
+    rejectedGeneration = generation;
+    rejectReason = reason;
+    return reason;
+}
+
+CANRejectReason SensorDecodePlan::Build(uint32_t mask, const std::map<uint8_t, Channel *> &channelMap, uint64_t generation)
+{
+    valid = false;
+    channelCount = 0;
+    runCount = 0;
+    dataLength = 0;
+
+    for (uint8_t channelID = 0; channelID < MAX_CHANNELS; channelID++)
+    {
+        if (((mask >> channelID) & 1) == 0)
+        {
+            continue;
+        }
+        auto it = channelMap.find(channelID);
+        if (it == channelMap.end())
+        {
+            return Reject(mask, generation, CANRejectReason::UNKNOWN_CHANNEL);
+        }
+        Channel *channel = it->second;
+
+        uint8_t width = channel->GetTypeSize();
+        if (width == 0 || width > 4 || dataLength + width > sizeof(SensorMsg_t::channel_data))
+        {
+            return Reject(mask, generation, CANRejectReason::INVALID_SENSOR_FRAME);
+        }
+
+        std::vector<double> scaling = channel->GetScaling();
+        channelIDs[channelCount] = channelID;
+        byteOffsets[channelCount] = dataLength;
+        slopes[channelCount] = scaling[0];
+        offsets[channelCount] = scaling[1];
+
+        if (runCount > 0 && runs[runCount - 1].width == width)
+        {
+            runs[runCount - 1].count++;
+        }
+        else
+        {
+            runs[runCount++] = {(uint8_t) channelCount, 1, width};
+        }
+
+        channelCount++;
+        dataLength += width;
+    }
+
+    channelMask = mask;
+    scalingGeneration = generation;
+    valid = true;
+    rejectReason = CANRejectReason::NONE;
+    return CANRejectReason::NONE;
+}
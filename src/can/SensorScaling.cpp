@@ -0,0 +1,186 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include "can/SensorScaling.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SENSOR_SCALING_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SENSOR_SCALING_NEON
+#endif
+
+namespace SensorScaling
+{
+    static inline int32_t ReadADC16(const uint8_t *raw)
+    {
+        return raw[1] << 8 | raw[0];
+    }
+
+    static inline int32_t ReadADC24(const uint8_t *raw)
+    {
+        return (int32_t) ((uint32_t) (raw[2] << 16 | raw[1] << 8 | raw[0]) << 8) >> 8;
+    }
+
+    static void ScaleADC16Scalar(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            values[i] = (double) ReadADC16(raw + 2 * i) * slopes[i] + offsets[i];
+        }
+    }
+
+    static void ScaleADC24Scalar(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            values[i] = (double) ReadADC24(raw + 3 * i) * slopes[i] + offsets[i];
+        }
+    }
+
+    static const Implementation_t scalarImplementation = {"scalar", ScaleADC16Scalar, ScaleADC24Scalar};
+
+#ifdef SENSOR_SCALING_X86
+    static void ScaleADC16SSE2(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i raw16 = _mm_loadl_epi64((const __m128i *) (raw + 2 * i));
+            __m128i raw32 = _mm_unpacklo_epi16(raw16, zero);
+            __m128d low = _mm_cvtepi32_pd(raw32);
+            __m128d high = _mm_cvtepi32_pd(_mm_srli_si128(raw32, 8));
+            low = _mm_add_pd(_mm_mul_pd(low, _mm_loadu_pd(slopes + i)), _mm_loadu_pd(offsets + i));
+            high = _mm_add_pd(_mm_mul_pd(high, _mm_loadu_pd(slopes + i + 2)), _mm_loadu_pd(offsets + i + 2));
+            _mm_storeu_pd(values + i, low);
+            _mm_storeu_pd(values + i + 2, high);
+        }
+        ScaleADC16Scalar(raw + 2 * i, slopes + i, offsets + i, values + i, count - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void ScaleADC16AVX2(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count)
+    {
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i raw32 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (raw + 2 * i)));
+            __m256d low = _mm256_cvtepi32_pd(_mm256_castsi256_si128(raw32));
+            __m256d high = _mm256_cvtepi32_pd(_mm256_extracti128_si256(raw32, 1));
+            low = _mm256_add_pd(_mm256_mul_pd(low, _mm256_loadu_pd(slopes + i)), _mm256_loadu_pd(offsets + i));
+            high = _mm256_add_pd(_mm256_mul_pd(high, _mm256_loadu_pd(slopes + i + 4)), _mm256_loadu_pd(offsets + i + 4));
+            _mm256_storeu_pd(values + i, low);
+            _mm256_storeu_pd(values + i + 4, high);
+        }
+        //the tail is legacy sse code, which is slowed down by dirty upper halves of the ymm registers
+        _mm256_zeroupper();
+        ScaleADC16SSE2(raw + 2 * i, slopes + i, offsets + i, values + i, count - i);
+    }
+
+    __attribute__((target("avx2")))
+    static void ScaleADC24AVX2(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count)
+    {
+        //moves the 3 bytes of each value into the upper bytes of a 32 bit lane, the arithmetic shift sign extends
+        const __m128i shuffle = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+        std::size_t i = 0;
+        //a 16 byte load for 4 values must stay within the 3 * count bytes
+        for (; i + 6 <= count; i += 4)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *) (raw + 3 * i));
+            __m128i raw32 = _mm_srai_epi32(_mm_shuffle_epi8(bytes, shuffle), 8);
+            __m256d scaled = _mm256_cvtepi32_pd(raw32);
+            scaled = _mm256_add_pd(_mm256_mul_pd(scaled, _mm256_loadu_pd(slopes + i)), _mm256_loadu_pd(offsets + i));
+            _mm256_storeu_pd(values + i, scaled);
+        }
+        _mm256_zeroupper();
+        ScaleADC24Scalar(raw + 3 * i, slopes + i, offsets + i, values + i, count - i);
+    }
+
+    static const Implementation_t sse2Implementation = {"sse2", ScaleADC16SSE2, ScaleADC24Scalar};
+    static const Implementation_t avx2Implementation = {"avx2", ScaleADC16AVX2, ScaleADC24AVX2};
+#endif
+
+#ifdef SENSOR_SCALING_NEON
+    static void ScaleADC16NEON(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count)
+    {
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            uint16x8_t raw16 = vreinterpretq_u16_u8(vld1q_u8(raw + 2 * i));
+            uint32x4_t raw32[2] = {vmovl_u16(vget_low_u16(raw16)), vmovl_u16(vget_high_u16(raw16))};
+            for (int half = 0; half < 2; half++)
+            {
+                std::size_t j = i + 4 * half;
+                float64x2_t low = vcvtq_f64_u64(vmovl_u32(vget_low_u32(raw32[half])));
+                float64x2_t high = vcvtq_f64_u64(vmovl_u32(vget_high_u32(raw32[half])));
+                low = vaddq_f64(vmulq_f64(low, vld1q_f64(slopes + j)), vld1q_f64(offsets + j));
+                high = vaddq_f64(vmulq_f64(high, vld1q_f64(slopes + j + 2)), vld1q_f64(offsets + j + 2));
+                vst1q_f64(values + j, low);
+                vst1q_f64(values + j + 2, high);
+            }
+        }
+        ScaleADC16Scalar(raw + 2 * i, slopes + i, offsets + i, values + i, count - i);
+    }
+
+    static void ScaleADC24NEON(const uint8_t *raw, const double *slopes, const double *offsets, double *values, std::size_t count)
+    {
+        //moves the 3 bytes of each value into the upper bytes of a 32 bit lane, out of range indices give 0
+        static const uint8_t shuffleBytes[16] = {0xFF, 0, 1, 2, 0xFF, 3, 4, 5, 0xFF, 6, 7, 8, 0xFF, 9, 10, 11};
+        const uint8x16_t shuffle = vld1q_u8(shuffleBytes);
+        std::size_t i = 0;
+        //a 16 byte load for 4 values must stay within the 3 * count bytes
+        for (; i + 6 <= count; i += 4)
+        {
+            uint8x16_t bytes = vqtbl1q_u8(vld1q_u8(raw + 3 * i), shuffle);
+            int32x4_t raw32 = vshrq_n_s32(vreinterpretq_s32_u8(bytes), 8);
+            float64x2_t low = vcvtq_f64_s64(vmovl_s32(vget_low_s32(raw32)));
+            float64x2_t high = vcvtq_f64_s64(vmovl_s32(vget_high_s32(raw32)));
+            low = vaddq_f64(vmulq_f64(low, vld1q_f64(slopes + i)), vld1q_f64(offsets + i));
+            high = vaddq_f64(vmulq_f64(high, vld1q_f64(slopes + i + 2)), vld1q_f64(offsets + i + 2));
+            vst1q_f64(values + i, low);
+            vst1q_f64(values + i + 2, high);
+        }
+        ScaleADC24Scalar(raw + 3 * i, slopes + i, offsets + i, values + i, count - i);
+    }
+
+    static const Implementation_t neonImplementation = {"neon", ScaleADC16NEON, ScaleADC24NEON};
+#endif
+
+    static std::vector<const Implementation_t *> SelectImplementations()
+    {
+        std::vector<const Implementation_t *> implementations;
+#ifdef SENSOR_SCALING_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            implementations.push_back(&avx2Implementation);
+        }
+        implementations.push_back(&sse2Implementation);
+#elif defined(SENSOR_SCALING_NEON)
+        //advanced simd is part of every armv8-a cpu
+        implementations.push_back(&neonImplementation);
+#endif
+        implementations.push_back(&scalarImplementation);
+        return implementations;
+    }
+
+    const std::vector<const Implementation_t *> &GetSupportedImplementations()
+    {
+        static const std::vector<const Implementation_t *> implementations = SelectImplementations();
+        return implementations;
+    }
+
+    const Implementation_t &GetImplementation()
+    {
+        static const Implementation_t &implementation = *GetSupportedImplementations().front();
+        return implementation;
+    }
+
+    const Implementation_t &GetScalarImplementation()
+    {
+        return scalarImplementation;
+    }
+}
@@ -14,6 +14,7 @@
 
 #define HEADER_SIZE 2
 #define MAX_MSG_LENGTH 65536
+#define MAX_BATCH_LENGTH 64
 
 UDPSocket::UDPSocket(std::string name, std::function<void()> onCloseCallback, std::string address, uint16_t port)
 {
@@ -146,6 +147,46 @@ void UDPSocket::Recv(UDPMessage *msg)
     }
 }
 
+size_t UDPSocket::RecvBatch(UDPMessage *msgs, size_t count)
+{
+    if (!connectionActive)
+    {
+        Debug::error("UDPSocket - %s: no connection active", name.c_str());
+        //TODO: write better exception
+        throw std::runtime_error("UDPSocket error");
+    }
+
+    struct mmsghdr headers[MAX_BATCH_LENGTH];
+    struct iovec buffers[MAX_BATCH_LENGTH];
+    count = std::min<size_t>(count, MAX_BATCH_LENGTH);
+    for (size_t i = 0; i < count; i++)
+    {
+        buffers[i] = {msgs[i].data, msgs[i].dataLength};
+        headers[i] = {};
+        headers[i].msg_hdr.msg_iov = &buffers[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    //waits for the first datagram only, the rest of the burst is taken as far as it is already queued
+    int received = recvmmsg(socketfd, headers, count, MSG_WAITFORONE, nullptr);
+    if (received < 0)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
+        }
+        Debug::error("UDPSocket - %s: error at recv occured, %s, closing socket...", name.c_str(), strerror(errno));
+        this->connectionActive = false;
+        //TODO: write better exception
+        throw std::runtime_error("UDPSocket error");
+    }
+
+    for (int i = 0; i < received; i++)
+    {
+        msgs[i].dataLength = headers[i].msg_len;
+    }
+    return received;
+}
 
 // std::vector<uint8_t> UDPSocket::newRecvBytes()
 // {
@@ -1,6 +1,8 @@
 #include "logging/InfluxDbLogger.h"
 #include <iostream>
 
+#include "utility/utils.h"
+
 InfluxDbLogger::InfluxDbLogger() {
 }
 
@@ -9,19 +11,59 @@ InfluxDbLogger::~InfluxDbLogger() {
 }
 
 void InfluxDbLogger::Init(std::string db_hostname, unsigned db_port, std::string db_name, std::string measurement,
-                            timestamp_precision_t precision, std::size_t buffer_size) {
+                            timestamp_precision_t precision, std::size_t buffer_size, InfluxDbWriterOptions options) {
     try {
-        dbWriter = new InfluxDbWriter(db_hostname, db_port, db_name, buffer_size);
-        dbWriter->Init();
+        dbWriter = new InfluxDbWriter(db_hostname, db_port, db_name, buffer_size, options);
         dbWriter->setMeasurement(measurement);
+        // Init starts the writer thread, which may replay the spool right away
         dbWriter->setTimestampPrecision(precision);
+        dbWriter->Init();
     }
     catch (const std::runtime_error &e) {
         throw std::runtime_error("Couldn't initialize InfluxDbLogger: " + std::string(e.what()));   
     }
 }
 
+InfluxDbWriterOptions InfluxDbLogger::ReadOptions(const nlohmann::json &influxConfig) {
+    InfluxDbWriterOptions options;
+    if (utils::keyExists(influxConfig, "buffer_amount")) {
+        options.buffer_amount = influxConfig["buffer_amount"];
+    }
+    if (utils::keyExists(influxConfig, "overflow_policy")) {
+        std::string policy = influxConfig["overflow_policy"];
+        if (policy == "drop") {
+            options.overflow_policy = OverflowPolicy::DROP;
+        }
+        else if (policy == "block") {
+            options.overflow_policy = OverflowPolicy::BLOCK;
+        }
+        else {
+            throw std::runtime_error("InfluxDbLogger - ReadOptions: unknown overflow_policy " + policy + ", expected drop or block");
+        }
+    }
+    if (utils::keyExists(influxConfig, "gzip_level")) {
+        options.gzip_level = influxConfig["gzip_level"];
+        if (options.gzip_level < 0 || options.gzip_level > 9) {
+            throw std::runtime_error("InfluxDbLogger - ReadOptions: gzip_level must be between 0 (off) and 9");
+        }
+    }
+    if (utils::keyExists(influxConfig, "spool_directory")) {
+        options.spool_directory = influxConfig["spool_directory"];
+    }
+    if (utils::keyExists(influxConfig, "spool_max_size")) {
+        options.spool_max_size = influxConfig["spool_max_size"];
+    }
+    if (utils::keyExists(influxConfig, "spool_replay_rate")) {
+        options.spool_replay_rate = influxConfig["spool_replay_rate"];
+        if (options.spool_replay_rate == 0) {
+            throw std::runtime_error("InfluxDbLogger - ReadOptions: spool_replay_rate must be greater than 0");
+        }
+    }
+    return options;
+}
+
 void InfluxDbLogger::log(std::string source, std::string msg, std::size_t timestamp, Severity severity) {
+    std::lock_guard<std::mutex> lock(logMtx);
     dbWriter->startDataPoint();
     dbWriter->addTag("source", source);
     dbWriter->addTag("severity", severityToString(severity));
@@ -31,6 +73,7 @@ void InfluxDbLogger::log(std::string source, std::string msg, std::size_t timest
 }
 
 void InfluxDbLogger::log(std::string key, std::size_t value, std::size_t timestamp){
+    std::lock_guard<std::mutex> lock(logMtx);
     dbWriter->startDataPoint();
     dbWriter->addTag("key", key);
     dbWriter->tagsDone();
@@ -39,6 +82,7 @@ void InfluxDbLogger::log(std::string key, std::size_t value, std::size_t timesta
 }
 
 void InfluxDbLogger::log(std::string key, double value, std::size_t timestamp){
+    std::lock_guard<std::mutex> lock(logMtx);
     dbWriter->startDataPoint();
     dbWriter->addTag("key", key);
     dbWriter->tagsDone();
@@ -47,13 +91,40 @@ void InfluxDbLogger::log(std::string key, double value, std::size_t timestamp){
 }
 
 void InfluxDbLogger::log(std::string key, bool value, std::size_t timestamp){
+    std::lock_guard<std::mutex> lock(logMtx);
     dbWriter->startDataPoint();
     dbWriter->addTag("key", key);
     dbWriter->tagsDone();
     dbWriter->addField("value", value);
     dbWriter->endDataPoint(timestamp);
 }
+std::string InfluxDbLogger::createSeriesKey(const std::string &key) {
+    std::lock_guard<std::mutex> lock(logMtx);
+    return dbWriter->createSeriesKey("key", key) + dbWriter->createFieldKey("value");
+}
+
+void InfluxDbLogger::logSeries(std::string_view seriesKey, double value, std::size_t timestamp) {
+    std::lock_guard<std::mutex> lock(logMtx);
+    dbWriter->addDataPoint(seriesKey, value, timestamp);
+}
+
+std::string InfluxDbLogger::createSeriesKey(const std::string &tagKey, const std::string &tagValue) {
+    std::lock_guard<std::mutex> lock(logMtx);
+    return dbWriter->createSeriesKey(tagKey, tagValue);
+}
+
+std::string InfluxDbLogger::createFieldKey(const std::string &fieldKey) {
+    std::lock_guard<std::mutex> lock(logMtx);
+    return dbWriter->createFieldKey(fieldKey);
+}
+
+void InfluxDbLogger::logSeries(std::string_view seriesKey, std::span<const std::string *> fieldKeys, std::span<const double> values, std::size_t timestamp) {
+    std::lock_guard<std::mutex> lock(logMtx);
+    dbWriter->addDataPoint(seriesKey, fieldKeys, values, timestamp);
+}
+
 /*template <typename T> void InfluxDbLogger::log(std::string key, T value, std::size_t timestamp){
+    std::lock_guard<std::mutex> lock(logMtx);
     dbWriter->startDataPoint();
     dbWriter->addTag("key", key);
     dbWriter->tagsDone();
@@ -62,5 +133,6 @@ void InfluxDbLogger::log(std::string key, bool value, std::size_t timestamp){
 }*/
 
 void InfluxDbLogger::flush() {
+    std::lock_guard<std::mutex> lock(logMtx);
     dbWriter->flush();
 }
\ No newline at end of file
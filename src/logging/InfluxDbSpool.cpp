@@ -0,0 +1,189 @@
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "logging/InfluxDbSpool.h"
+#include "utility/Debug.h"
+
+InfluxDbSpool::InfluxDbSpool(std::string file_path, std::size_t max_size) : file_path(std::move(file_path)), max_size(max_size) {
+}
+
+InfluxDbSpool::~InfluxDbSpool() {
+    if (segment != nullptr) {
+        msync(segment, max_size, MS_SYNC);
+        munmap(segment, max_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void InfluxDbSpool::open() {
+    if (max_size < HEADER_SIZE + 2 * sizeof(RecordHeader_t)) {
+        throw std::runtime_error("InfluxDbSpool: spool size too small");
+    }
+
+    std::filesystem::path path(file_path);
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path());
+    }
+
+    fd = ::open(file_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("InfluxDbSpool: couldn't open " + file_path + ": " + std::strerror(errno));
+    }
+
+    off_t file_size = lseek(fd, 0, SEEK_END);
+    bool fresh = file_size < (off_t) HEADER_SIZE;
+    if (file_size != (off_t) max_size && ftruncate(fd, max_size) < 0) {
+        throw std::runtime_error("InfluxDbSpool: couldn't resize " + file_path + ": " + std::strerror(errno));
+    }
+
+    void *mapped = mmap(nullptr, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("InfluxDbSpool: couldn't map " + file_path + ": " + std::strerror(errno));
+    }
+    segment = (char *) mapped;
+
+    if (fresh || header()->magic != SPOOL_MAGIC || file_size != (off_t) max_size) {
+        // new file, foreign content or a different size configured, records can't be trusted
+        reset();
+    }
+    else {
+        recover();
+    }
+}
+
+InfluxDbSpool::SpoolHeader_t *InfluxDbSpool::header() {
+    return (SpoolHeader_t *) segment;
+}
+
+InfluxDbSpool::RecordHeader_t *InfluxDbSpool::recordAt(std::size_t offset) {
+    return (RecordHeader_t *) &segment[offset];
+}
+
+std::size_t InfluxDbSpool::recordSize(std::size_t length) {
+    return sizeof(RecordHeader_t) + ((length + 7) & ~(std::size_t) 7);
+}
+
+/**
+ * FNV-1a, only needs to detect torn writes and stale data, not tampering
+ */
+uint32_t InfluxDbSpool::checksum(const char *data, std::size_t length) {
+    uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void InfluxDbSpool::reset() {
+    header()->magic = SPOOL_MAGIC;
+    header()->read_offset = HEADER_SIZE;
+    write_offset = HEADER_SIZE;
+    recordAt(write_offset)->length = 0;
+    syncRange(0, HEADER_SIZE + sizeof(RecordHeader_t));
+}
+
+/**
+ * starts writing back the pages of the range without waiting for it
+ */
+void InfluxDbSpool::syncRange(std::size_t offset, std::size_t length) {
+    std::size_t page_size = sysconf(_SC_PAGESIZE);
+    std::size_t start = offset & ~(page_size - 1);
+    std::size_t end = std::min(offset + length, max_size);
+    msync(&segment[start], end - start, MS_ASYNC);
+}
+
+void InfluxDbSpool::recover() {
+    std::size_t offset = header()->read_offset;
+    if (offset < HEADER_SIZE || offset + sizeof(RecordHeader_t) > max_size || (offset & 7) != 0) {
+        reset();
+        return;
+    }
+
+    std::size_t records = 0;
+    while (offset + sizeof(RecordHeader_t) <= max_size) {
+        RecordHeader_t *record = recordAt(offset);
+        if (record->length == 0 || offset + recordSize(record->length) > max_size) {
+            break;
+        }
+        if (record->checksum != checksum(&segment[offset + sizeof(RecordHeader_t)], record->length)) {
+            Debug::warning("InfluxDbSpool: discarding corrupt record in %s", file_path.c_str());
+            break;
+        }
+        offset += recordSize(record->length);
+        records++;
+    }
+
+    write_offset = offset;
+    if (write_offset + sizeof(RecordHeader_t) <= max_size) {
+        recordAt(write_offset)->length = 0;
+    }
+    if (records > 0) {
+        Debug::print("InfluxDbSpool: recovered %zu unsent buffers from %s", records, file_path.c_str());
+    }
+    else {
+        reset();
+    }
+}
+
+bool InfluxDbSpool::append(const char *data, std::size_t length) {
+    std::size_t size = recordSize(length);
+    // room for the record and the terminating header behind it
+    if (length == 0 || length > UINT32_MAX || write_offset + size + sizeof(RecordHeader_t) > max_size) {
+        dropped_buffers++;
+        return false;
+    }
+
+    std::memcpy(&segment[write_offset + sizeof(RecordHeader_t)], data, length);
+    recordAt(write_offset + size)->length = 0;
+
+    // header last, a crash before this leaves the previous terminator in place
+    RecordHeader_t *record = recordAt(write_offset);
+    record->checksum = checksum(data, length);
+    std::atomic_thread_fence(std::memory_order_release);
+    record->length = length;
+
+    syncRange(write_offset, size + sizeof(RecordHeader_t));
+    write_offset += size;
+    return true;
+}
+
+bool InfluxDbSpool::peek(const char *&data, std::size_t &length) {
+    if (empty()) {
+        return false;
+    }
+    RecordHeader_t *record = recordAt(header()->read_offset);
+    data = &segment[header()->read_offset + sizeof(RecordHeader_t)];
+    length = record->length;
+    return true;
+}
+
+void InfluxDbSpool::pop() {
+    if (empty()) {
+        return;
+    }
+    header()->read_offset += recordSize(recordAt(header()->read_offset)->length);
+    if (header()->read_offset >= write_offset) {
+        reset();
+    }
+}
+
+bool InfluxDbSpool::empty() {
+    return segment == nullptr || header()->read_offset >= write_offset;
+}
+
+std::size_t InfluxDbSpool::getSpooledBytes() {
+    return empty() ? 0 : write_offset - header()->read_offset;
+}
+
+std::size_t InfluxDbSpool::getDroppedBuffers() {
+    return dropped_buffers;
+}
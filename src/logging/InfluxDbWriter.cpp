@@ -1,40 +1,93 @@
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <charconv>
+#include <cmath>
+
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
 
 #include "logging/InfluxDbWriter.h"
 #include "logging/influxDb.h"
 #include "utility/Debug.h"
 
-using namespace std::chrono_literals;
-
-InfluxDbWriter::InfluxDbWriter(std::string hostname, unsigned port, std::string dbName, std::size_t bufferSize) : buffer_size(bufferSize) {
+InfluxDbWriter::InfluxDbWriter(std::string hostname, unsigned port, std::string dbName, std::size_t bufferSize, InfluxDbWriterOptions options)
+    : buffer_size(bufferSize), buffer_amount(std::max<std::size_t>(options.buffer_amount, 2)), overflow_policy(options.overflow_policy), gzip_level(options.gzip_level),
+      spool_directory(options.spool_directory), spool_max_size(options.spool_max_size), spool_replay_rate(options.spool_replay_rate) {
     host = hostname;
     db = dbName;
     portStr = std::to_string(port);
 }
 
 void InfluxDbWriter::Init() {
-    buffer = new char*[buffer_amount];
+    buffers.reserve(buffer_amount);
     for (size_t i = 0; i < buffer_amount; i++)
     {
-        buffer[i] = new char[buffer_size];
+        buffers.push_back(new char[buffer_size]);
+    }
+    buffer = buffers[0];
+    free_buffers.assign(buffers.begin() + 1, buffers.end());
+
+    if (!spool_directory.empty()) {
+        spool = std::make_unique<InfluxDbSpool>(spool_directory + "/" + db + "_" + measurement + ".spool", spool_max_size);
+        spool->open();
+        spooled_bytes = spool->getSpooledBytes();
     }
 
+    last_connect_attempt = std::chrono::steady_clock::now();
     if(initDbContext(&cntxt, host.c_str(), portStr.c_str(), db.c_str()) < 0) {
-        throw std::runtime_error("Couldn't initialize influxDbWriter (bad context)");
+        if (spool == nullptr) {
+            throw std::runtime_error("Couldn't initialize influxDbWriter (bad context)");
+        }
+        // with a spool nothing is lost while the server is down, keep trying in the background
+        Debug::warning("InfluxDbWriter: %s:%s not reachable, spooling until it is", host.c_str(), portStr.c_str());
+        connected = false;
+    }
+    else {
+        connected = true;
+    }
+
+    if (gzip_level > 0) {
+#ifndef NO_ZLIB
+        zstream = new z_stream();
+        // 16 + MAX_WBITS writes a gzip instead of a zlib header
+        if (deflateInit2(zstream, gzip_level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            delete zstream;
+            zstream = nullptr;
+            throw std::runtime_error("Couldn't initialize influxDbWriter (gzip level " + std::to_string(gzip_level) + " not supported)");
+        }
+        compress_buffer.resize(deflateBound(zstream, buffer_size));
+#else
+        Debug::warning("InfluxDbWriter: built without zlib, gzip_level ignored, sending uncompressed");
+#endif
     }
+
+    running = true;
+    writer_thread = std::thread(&InfluxDbWriter::writerLoop, this);
 }
 
 InfluxDbWriter::~InfluxDbWriter() { 
-    push();
-    joinThreads();
-
-    if(buffer != nullptr) {
-        for (size_t i = 0; i < buffer_amount; i++)
+    if (writer_thread.joinable()) {
+        push();
         {
-            delete buffer[i];
+            std::lock_guard<std::mutex> lock(queue_mtx);
+            running = false;
         }
-        delete buffer;
+        queue_cv.notify_all();
+        writer_thread.join();
+    }
+
+    for (char *buf : buffers) {
+        delete[] buf;
+    }
+
+#ifndef NO_ZLIB
+    if (zstream != nullptr) {
+        deflateEnd(zstream);
+        delete zstream;
     }
+#endif
     
     (void) deInitDbContext(&cntxt);
 }
@@ -49,114 +102,425 @@ void InfluxDbWriter::setTimestampPrecision(timestamp_precision_t precision) {
     set_timestamp_precision(&cntxt, precision);
 }
 
-void InfluxDbWriter::setMeasurement(std::string measurement) {
+void InfluxDbWriter::setMeasurement(const std::string &measurement) {
     this->measurement = measurement;
 }
 
-void InfluxDbWriter::startDataPoint() {
-    if((buffer_size - buffer_pos) < (measurement.length())) {
+/**
+ * makes sure length more bytes fit into the current buffer, pushes the complete data points if not
+ * @return false if the data point under construction can't fit into an empty buffer, it gets discarded then
+ */
+bool InfluxDbWriter::reserve(std::size_t length) {
+    if (point_overflow) {
+        return false;
+    }
+    if ((buffer_size - buffer_pos) < length) {
         push();
+        if ((buffer_size - buffer_pos) < length) {
+            point_overflow = true;
+            return false;
+        }
     }
-    
-    buffer_pos += sprintf(&buffer[buffer_sel][buffer_pos], "%s", this->measurement.c_str());
+    return true;
 }
 
-void InfluxDbWriter::addTag(std::string key, std::string value) {
-    if((buffer_size - buffer_pos) < (key.length() + value.length() + 2)) {
-        push();
+void InfluxDbWriter::append(std::string_view str) {
+    std::memcpy(&buffer[buffer_pos], str.data(), str.length());
+    buffer_pos += str.length();
+}
+
+void InfluxDbWriter::startDataPoint() {
+    if (reserve(measurement.length())) {
+        append(measurement);
+    }
+}
+
+void InfluxDbWriter::addTag(const std::string &key, const std::string &value) {
+    if (reserve(key.length() + value.length() + 2)) {
+        buffer[buffer_pos++] = ',';
+        append(key);
+        buffer[buffer_pos++] = '=';
+        append(value);
     }
-    buffer_pos += sprintf(&buffer[buffer_sel][buffer_pos], ",%s=%s", key.c_str(), value.c_str());
 }
 
 void InfluxDbWriter::tagsDone() {
-    if((buffer_size - buffer_pos) < 1) {
-        push();
+    if (reserve(1)) {
+        buffer[buffer_pos++] = ' ';
     }
-    buffer[buffer_sel][buffer_pos] = ' ';
-    buffer_pos++;
 }
 
 // Properly sanitize strings if needed, neglected so far because of the overhead (DB)
-void InfluxDbWriter::addField(std::string key, std::string value) {
-    if((buffer_size - buffer_pos) < (key.length() + value.length() + 4)) {
-        push();
+void InfluxDbWriter::addField(const std::string &key, const std::string &value) {
+    if (reserve(key.length() + value.length() + 4)) {
+        append(key);
+        append("=\"");
+        append(value);
+        append("\",");
     }
-    buffer_pos += sprintf(&buffer[buffer_sel][buffer_pos], "%s=\"%s\",", key.c_str(), value.c_str());
 }
 
-
-void InfluxDbWriter::addField(std::string key, std::size_t value) {
-    std::string str = std::to_string(value);
-    if((buffer_size - buffer_pos) < (key.length() + str.length() + 3)) {
-        push();
+void InfluxDbWriter::addField(const std::string &key, std::size_t value) {
+    if (reserve(key.length() + MAX_INT_CHARS + 3)) {
+        append(key);
+        buffer[buffer_pos++] = '=';
+        buffer_pos = std::to_chars(&buffer[buffer_pos], &buffer[buffer_size], value).ptr - buffer;
+        append("i,");
     }
-    buffer_pos += sprintf(&buffer[buffer_sel][buffer_pos], "%s=%si,", key.c_str(), str.c_str());
 }
 
-// Might let user select the precision and scientific notation
-void InfluxDbWriter::addField(std::string key, double value) {
-    std::string str = std::to_string(value);
+void InfluxDbWriter::addField(const std::string &key, double value) {
+    if (reserve(key.length() + MAX_DOUBLE_CHARS + 2)) {
+        append(key);
+        buffer[buffer_pos++] = '=';
+        // shortest representation that round trips, so no precision is lost in the database
+        buffer_pos = std::to_chars(&buffer[buffer_pos], &buffer[buffer_size], value).ptr - buffer;
+        buffer[buffer_pos++] = ',';
+    }
+}
 
-    if((buffer_size - buffer_pos) < (key.length() + str.length() + 2)) {
-        push();
+void InfluxDbWriter::addField(const std::string &key, bool value) {
+    if (reserve(key.length() + 3)) {
+        append(key);
+        buffer[buffer_pos++] = '=';
+        buffer[buffer_pos++] = value ? 't' : 'f';
+        buffer[buffer_pos++] = ',';
     }
-    buffer_pos += sprintf(&buffer[buffer_sel][buffer_pos], "%s=%s,", key.c_str(), str.c_str());
 }
 
-void InfluxDbWriter::addField(std::string key, bool value) {
-    char c = value ? 't' : 'f';
+void InfluxDbWriter::endDataPoint(std::size_t timestamp) {
+    if (reserve(MAX_INT_CHARS + 1)) {
+        // replace the separator of the last field
+        buffer[buffer_pos-1] = ' ';
+        buffer_pos = std::to_chars(&buffer[buffer_pos], &buffer[buffer_size], timestamp).ptr - buffer;
+        buffer[buffer_pos++] = '\n';
+        last_measurement = buffer_pos;
+    }
+    else {
+        // data point longer than a whole buffer, drop it
+        buffer_pos = last_measurement;
+        point_overflow = false;
+        dropped_points++;
+    }
+}
 
-    if((buffer_size - buffer_pos) < (key.length() + 2)) {
-        push();
+/**
+ * escapes the characters line protocol treats as separators in tag keys, tag values and field keys
+ */
+static void appendEscaped(std::string &dst, const std::string &src) {
+    for (char c : src) {
+        if (c == ',' || c == '=' || c == ' ') {
+            dst += '\\';
+        }
+        dst += c;
     }
-    buffer_pos += sprintf(&buffer[buffer_sel][buffer_pos], "%s=%c,", key.c_str(), c);
 }
 
-void InfluxDbWriter::endDataPoint(std::size_t timestamp) {
-    std::string ts_str = std::to_string(timestamp);
-    
-    if((buffer_size - buffer_pos) < (ts_str.length() + 1)) {
-        push();
+std::string InfluxDbWriter::createSeriesKey(const std::string &tagKey, const std::string &tagValue) {
+    std::string seriesKey = measurement + ",";
+    appendEscaped(seriesKey, tagKey);
+    seriesKey += '=';
+    appendEscaped(seriesKey, tagValue);
+    seriesKey += ' ';
+    return seriesKey;
+}
+
+std::string InfluxDbWriter::createFieldKey(const std::string &fieldKey) {
+    std::string escaped;
+    appendEscaped(escaped, fieldKey);
+    escaped += '=';
+    return escaped;
+}
+
+void InfluxDbWriter::addDataPoint(std::string_view seriesKey, double value, std::size_t timestamp) {
+    if (!std::isfinite(value)) {
+        // influx rejects the whole request if a single field is nan or inf
+        dropped_points++;
+        return;
+    }
+    if (!reserve(seriesKey.length() + MAX_DOUBLE_CHARS + MAX_INT_CHARS + 2)) {
+        point_overflow = false;
+        dropped_points++;
+        return;
     }
-    buffer[buffer_sel][buffer_pos-1] = ' ';
-    buffer_pos += sprintf(&buffer[buffer_sel][buffer_pos], "%s\n", ts_str.c_str());
-    last_measurement = buffer_pos-1;
+    append(seriesKey);
+    buffer_pos = std::to_chars(&buffer[buffer_pos], &buffer[buffer_size], value).ptr - buffer;
+    buffer[buffer_pos++] = ' ';
+    buffer_pos = std::to_chars(&buffer[buffer_pos], &buffer[buffer_size], timestamp).ptr - buffer;
+    buffer[buffer_pos++] = '\n';
+    last_measurement = buffer_pos;
 }
 
+/**
+ * hands all complete data points of the current buffer to the writer thread and continues in a free buffer
+ * the incomplete data point at the end of the buffer is moved over to the new buffer
+ */
 void InfluxDbWriter::push() { 
     // Might throw an exception if last measurement = 0 as this equals a too long entry (DB)
     if (last_measurement > 0) {
-        joinThreads();
-        threads.push_back(std::thread(sendData, &cntxt, this->buffer[buffer_sel],  last_measurement));
-        transferPartialWrite();
-        buffer_sel = (buffer_sel + 1) & 0b1;
+        char *next = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(queue_mtx);
+            if (free_buffers.empty() && overflow_policy == OverflowPolicy::BLOCK) {
+                free_cv.wait(lock, [this] { return !free_buffers.empty() || !running; });
+            }
+
+            if (!free_buffers.empty()) {
+                next = free_buffers.back();
+                free_buffers.pop_back();
+            }
+            else if (!send_queue.empty()) {
+                // pool exhausted, sacrifice the oldest queued data to keep the producer going
+                next = send_queue.front().first;
+                send_queue.pop_front();
+                dropped_buffers++;
+            }
+
+            if (next != nullptr) {
+                send_queue.emplace_back(buffer, last_measurement);
+            }
+            else {
+                // the only other buffer is in flight, drop what we have formatted so far
+                dropped_buffers++;
+            }
+        }
+        queue_cv.notify_one();
+
+        transferPartialWrite(next);
     }
 }
 
-void InfluxDbWriter::transferPartialWrite() {
-    std::size_t i = last_measurement;
-    
-    while(i < buffer_pos)
-    {
-        buffer[(buffer_sel + 1) & 0b1][i - last_measurement] = buffer[buffer_sel][i];   
-        i++;
+/**
+ * @param next buffer to continue in, nullptr to keep the current one
+ */
+void InfluxDbWriter::transferPartialWrite(char *next) {
+    if (next == nullptr) {
+        next = buffer;
     }
+    std::memmove(next, &buffer[last_measurement], buffer_pos - last_measurement);
 
-    buffer_pos = i - last_measurement;
+    buffer = next;
+    buffer_pos = buffer_pos - last_measurement;
     last_measurement = 0;
 }
 
-void InfluxDbWriter::joinThreads() {
-    for (std::thread &t : threads) {
-        if(t.joinable()) 
+void InfluxDbWriter::writerLoop() {
+    last_replay = std::chrono::steady_clock::now();
+    while (true) {
+        std::pair<char *, std::size_t> item = {nullptr, 0};
         {
-            std::this_thread::sleep_for(10ms);
-            if(t.joinable()) t.join();
+            std::unique_lock<std::mutex> lock(queue_mtx);
+            auto ready = [this] { return !send_queue.empty() || !running; };
+            if (spool != nullptr && !spool->empty()) {
+                queue_cv.wait_for(lock, REPLAY_INTERVAL, ready);
+            }
+            else {
+                queue_cv.wait(lock, ready);
+            }
+            if (!send_queue.empty()) {
+                item = send_queue.front();
+                send_queue.pop_front();
+            }
+            else if (!running) {
+                // whatever is still spooled is replayed after the next start
+                break;
+            }
+        }
+
+        if (item.first != nullptr) {
+            sendBuffer(item.first, item.second);
+
+            {
+                std::lock_guard<std::mutex> lock(queue_mtx);
+                free_buffers.push_back(item.first);
+            }
+            free_cv.notify_one();
+        }
+
+        if (spool != nullptr) {
+            replaySpool();
+        }
+    }
+}
+
+bool InfluxDbWriter::connect() {
+    if (cntxt.sock_fd < 0) {
+        // don't stall the writer thread on connect timeouts for every buffer while the server is down
+        auto now = std::chrono::steady_clock::now();
+        if (!connected && now - last_connect_attempt < RECONNECT_INTERVAL) {
+            return false;
+        }
+        last_connect_attempt = now;
+    }
+    if (cntxt.sock_fd < 0 && reconnectDbContext(&cntxt) < 0) {
+        if (connected) {
+            Debug::warning("InfluxDbWriter: lost connection to %s:%s", host.c_str(), portStr.c_str());
+        }
+        connected = false;
+        return false;
+    }
+    if (!connected) {
+        Debug::warning("InfluxDbWriter: reconnected to %s:%s", host.c_str(), portStr.c_str());
+    }
+    connected = true;
+    return true;
+}
+
+/**
+ * sends the buffer, if that fails it is spooled (if enabled) or dropped, buffers the server rejects are dropped
+ */
+void InfluxDbWriter::sendBuffer(char *data, std::size_t length) {
+    // live data goes out before the backlog, every point carries its timestamp so the order doesn't matter to influx
+    TransmitResult result = transmit(data, length);
+    if (result == TransmitResult::SENT) {
+        return;
+    }
+    if (result == TransmitResult::FAILED && spool != nullptr && spool->append(data, length)) {
+        spooled_bytes = spool->getSpooledBytes();
+        return;
+    }
+    dropped_buffers++;
+}
+
+/**
+ * sends on the kept alive connection, reconnects once if the server closed it in the meantime
+ * only a 2xx status counts as sent
+ */
+InfluxDbWriter::TransmitResult InfluxDbWriter::transmit(const char *data, std::size_t length) {
+    const char *content_encoding = nullptr;
+    std::size_t compressed_length = 0;
+    if (zstream != nullptr && compress(data, length, compressed_length)) {
+        data = compress_buffer.data();
+        length = compressed_length;
+        content_encoding = "gzip";
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!connect()) {
+            break;
+        }
+        int status = sendDataEncoded(&cntxt, const_cast<char *>(data), length, content_encoding);
+        if (status >= 200 && status < 300) {
+            return TransmitResult::SENT;
+        }
+        if (status >= 400 && status < 500) {
+            Debug::error("InfluxDbWriter: %s rejected %zu bytes of %s with status %d, dropping them", host.c_str(), length, measurement.c_str(), status);
+            return TransmitResult::REJECTED;
+        }
+        if (status >= 0) {
+            // the connection is fine, the server is restarting or overloaded
+            Debug::warning("InfluxDbWriter: %s answered with status %d, retrying later", host.c_str(), status);
+            return TransmitResult::FAILED;
+        }
+        (void) deInitDbContext(&cntxt);
+    }
+    return TransmitResult::FAILED;
+}
+
+/**
+ * replays spooled buffers oldest first, limited to spool_replay_rate bytes per second
+ */
+void InfluxDbWriter::replaySpool() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - last_replay).count();
+    last_replay = now;
+    replay_budget = std::min(replay_budget + elapsed * spool_replay_rate, (double) spool_replay_rate);
+
+    const char *data;
+    std::size_t length;
+    // a record bigger than the rate still goes out once the budget is full instead of blocking forever
+    while (replay_budget > 0 && spool->peek(data, length)) {
+        TransmitResult result = transmit(data, length);
+        if (result == TransmitResult::FAILED) {
+            break;
         }
-        else Debug::warning("InfluxDbWriter thread was not joinable.");
+        if (result == TransmitResult::REJECTED) {
+            dropped_buffers++;
+        }
+        spool->pop();
+        replay_budget -= length;
+        spooled_bytes = spool->getSpooledBytes();
+        if (spool->empty()) {
+            Debug::print("InfluxDbWriter: replayed spool of %s", measurement.c_str());
+        }
+    }
+}
+
+/**
+ * gzips the data into compress_buffer, the stream is reset instead of reallocated for every buffer
+ * @return false if compression failed, the data should be sent uncompressed then
+ */
+bool InfluxDbWriter::compress(const char *data, std::size_t length, std::size_t &compressed_length) {
+#ifndef NO_ZLIB
+    if (deflateReset(zstream) != Z_OK) {
+        return false;
     }
-} 
+    // spooled records can be bigger than a single buffer
+    if (deflateBound(zstream, length) > compress_buffer.size()) {
+        compress_buffer.resize(deflateBound(zstream, length));
+    }
+    zstream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    zstream->avail_in = length;
+    zstream->next_out = reinterpret_cast<Bytef *>(compress_buffer.data());
+    zstream->avail_out = compress_buffer.size();
+
+    if (deflate(zstream, Z_FINISH) != Z_STREAM_END) {
+        return false;
+    }
+    compressed_length = zstream->total_out;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void InfluxDbWriter::addDataPoint(std::string_view seriesKey, std::span<const std::string *> fieldKeys, std::span<const double> values, std::size_t timestamp) {
+    std::size_t length = seriesKey.length() + MAX_INT_CHARS + 1;
+    for (std::size_t i = 0; i < fieldKeys.size(); i++) {
+        length += fieldKeys[i]->length() + MAX_DOUBLE_CHARS + 1;
+    }
+    if (!reserve(length)) {
+        point_overflow = false;
+        dropped_points++;
+        return;
+    }
+
+    std::size_t start = buffer_pos;
+    append(seriesKey);
+    std::size_t fieldsStart = buffer_pos;
+    for (std::size_t i = 0; i < fieldKeys.size() && i < values.size(); i++) {
+        if (!std::isfinite(values[i])) {
+            // influx rejects the whole request if a single field is nan or inf, leave the field out
+            continue;
+        }
+        append(*fieldKeys[i]);
+        buffer_pos = std::to_chars(&buffer[buffer_pos], &buffer[buffer_size], values[i]).ptr - buffer;
+        buffer[buffer_pos++] = ',';
+    }
+    if (buffer_pos == fieldsStart) {
+        // a data point needs at least one field
+        buffer_pos = start;
+        dropped_points++;
+        return;
+    }
+    buffer[buffer_pos-1] = ' ';
+    buffer_pos = std::to_chars(&buffer[buffer_pos], &buffer[buffer_size], timestamp).ptr - buffer;
+    buffer[buffer_pos++] = '\n';
+    last_measurement = buffer_pos;
+}
 
 void InfluxDbWriter::flush() {
     push();
 }
+
+std::size_t InfluxDbWriter::getDroppedBuffers() {
+    return dropped_buffers;
+}
+
+std::size_t InfluxDbWriter::getDroppedPoints() {
+    return dropped_points;
+}
+
+std::size_t InfluxDbWriter::getSpooledBytes() {
+    return spooled_bytes;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -5,7 +6,6 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
-//#include <zlib.h>
 
 #include "logging/influxDb.h"
 
@@ -42,24 +42,18 @@ void set_credentials(influxDbContext *cntxt, const char *username, const char *p
     safe_str_cpy(cntxt->password, password, SETTINGS_LENGTH);
 }
 
-int initDbContext(influxDbContext *cntxt, const char *hostname, const char *port, const char *database) {
+static int connect_socket(influxDbContext *cntxt) {
     struct addrinfo hints, *ai = NULL;
 
     cntxt->sock_fd = -1;
-    memset(cntxt->user, 0, SETTINGS_LENGTH);
-    memset(cntxt->password, 0, SETTINGS_LENGTH);
-    memset(cntxt->ts_precision, 0, SETTINGS_LENGTH);
-
-    safe_str_cpy(cntxt->hostname, hostname, SETTINGS_LENGTH);
-    safe_str_cpy(cntxt->port, port, SETTINGS_LENGTH);
-    safe_str_cpy(cntxt->db_name, database, SETTINGS_LENGTH);
 
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
 
     do {
-        if(getaddrinfo(hostname, port, &hints, &ai) != 0) {
+        if(getaddrinfo(cntxt->hostname, cntxt->port, &hints, &ai) != 0) {
+            ai = NULL;
             break;
         }
 
@@ -76,46 +70,147 @@ int initDbContext(influxDbContext *cntxt, const char *hostname, const char *port
     }
     while (0);
 
-    freeaddrinfo(ai);
+    if (ai != NULL) {
+        freeaddrinfo(ai);
+    }
 
     return cntxt->sock_fd;
 }
 
-int deInitDbContext(influxDbContext *cntxt) {
-    return close(cntxt->sock_fd);
+int initDbContext(influxDbContext *cntxt, const char *hostname, const char *port, const char *database) {
+    memset(cntxt->user, 0, SETTINGS_LENGTH);
+    memset(cntxt->password, 0, SETTINGS_LENGTH);
+    memset(cntxt->ts_precision, 0, SETTINGS_LENGTH);
+
+    safe_str_cpy(cntxt->hostname, hostname, SETTINGS_LENGTH);
+    safe_str_cpy(cntxt->port, port, SETTINGS_LENGTH);
+    safe_str_cpy(cntxt->db_name, database, SETTINGS_LENGTH);
+
+    return connect_socket(cntxt);
 }
 
+int reconnectDbContext(influxDbContext *cntxt) {
+    if (cntxt->sock_fd >= 0) {
+        (void) close(cntxt->sock_fd);
+    }
+    return connect_socket(cntxt);
+}
 
-int sendData(influxDbContext *cntxt, char *data, size_t length) {
-    char http_header[2048];
-    size_t ret;
-    size_t header_length = 0, sent = 0;
-    char result[1024];
+int deInitDbContext(influxDbContext *cntxt) {
+    int ret = 0;
+    if (cntxt->sock_fd >= 0) {
+        ret = close(cntxt->sock_fd);
+        cntxt->sock_fd = -1;
+    }
+    return ret;
+}
 
-    header_length += snprintf(http_header, 2048, "POST /write?db=%s%s%s%s HTTP/1.1\r\nHost: %s:%s\r\nContent-Length: %zd\r\n\r\n",
-            cntxt->db_name, cntxt->user, cntxt->password, cntxt->ts_precision, cntxt->hostname, cntxt->port, length);
+static int write_all(int sock_fd, const char *data, size_t length, int flags) {
+    size_t sent = 0;
+    ssize_t ret;
 
-    while (sent < header_length) {
-        ret = write(cntxt->sock_fd, &http_header[sent], header_length - sent);
+    while (sent < length) {
+        // MSG_NOSIGNAL: a connection closed by the server must not kill the process with SIGPIPE
+        ret = send(sock_fd, &data[sent], length - sent, MSG_NOSIGNAL | flags);
         if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             return -1;
         }
         sent = sent + ret;
     }
-    sent = 0;
+    return 0;
+}
+
+/**
+ * reads a complete http response so the next request on the kept alive connection starts clean
+ * returns the http status code or -1 if the connection broke
+ */
+static int read_response(influxDbContext *cntxt) {
+    char result[2048];
+    size_t received = 0;
+    ssize_t ret;
+    char *header_end = NULL;
+    long content_length = 0;
+    int status = -1;
+
+    while (header_end == NULL) {
+        if (received >= sizeof(result) - 1) {
+            return -1;
+        }
+        ret = read(cntxt->sock_fd, &result[received], sizeof(result) - 1 - received);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        received += ret;
+        result[received] = '\0';
+        header_end = strstr(result, "\r\n\r\n");
+    }
 
-    while (sent < length) {
-        ret = write(cntxt->sock_fd, &data[sent], length - sent);
-        if (ret < 0) {
+    if (sscanf(result, "HTTP/%*s %d", &status) != 1) {
+        return -1;
+    }
+
+    char *content_length_str = strcasestr(result, "Content-Length:");
+    if (content_length_str != NULL && content_length_str < header_end) {
+        content_length = strtol(content_length_str + strlen("Content-Length:"), NULL, 10);
+    }
+
+    char *connection_close = strcasestr(result, "Connection: close");
+    int close_connection = connection_close != NULL && connection_close < header_end;
+
+    // drain the body, influx only sends one for errors
+    long remaining = content_length - (long)(received - (header_end + 4 - result));
+    while (remaining > 0) {
+        ret = read(cntxt->sock_fd, result, remaining < (long) sizeof(result) ? (size_t) remaining : sizeof(result));
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
             return -1;
         }
-        sent = sent + ret;
+        remaining -= ret;
     }
 
-    // If needed -> extract response code (DB)
-    read(cntxt->sock_fd, result, sizeof(result));
-    // fprintf(stdout, "Result %s\n", result);
+    if (close_connection) {
+        (void) deInitDbContext(cntxt);
+    }
 
-    return 0;
+    return status;
 }
 
+int sendData(influxDbContext *cntxt, char *data, size_t length) {
+    return sendDataEncoded(cntxt, data, length, NULL);
+}
+
+int sendDataEncoded(influxDbContext *cntxt, char *data, size_t length, const char *content_encoding) {
+    char http_header[2048];
+    size_t header_length = 0;
+
+    if (cntxt->sock_fd < 0) {
+        return -1;
+    }
+
+    header_length += snprintf(http_header, 2048, "POST /write?db=%s%s%s%s HTTP/1.1\r\nHost: %s:%s\r\nConnection: keep-alive\r\n%s%s%sContent-Length: %zd\r\n\r\n",
+            cntxt->db_name, cntxt->user, cntxt->password, cntxt->ts_precision, cntxt->hostname, cntxt->port,
+            content_encoding != NULL ? "Content-Encoding: " : "",
+            content_encoding != NULL ? content_encoding : "",
+            content_encoding != NULL ? "\r\n" : "",
+            length);
+
+    // MSG_MORE: header and body leave in the same segment, otherwise nagle holds back the body until the
+    // delayed ack of the header arrives on a kept alive connection
+    if (write_all(cntxt->sock_fd, http_header, header_length, MSG_MORE) < 0) {
+        return -1;
+    }
+
+    if (write_all(cntxt->sock_fd, data, length, 0) < 0) {
+        return -1;
+    }
+
+    return read_response(cntxt);
+}
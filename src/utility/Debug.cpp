@@ -33,7 +33,8 @@ void Debug::Init(Config &config)
                      config["/INFLUXDB/database_port"],
                      config["/INFLUXDB/database_name"],
                      config["/INFLUXDB/debug_measurement"], MILLISECONDS,
-                     config["/INFLUXDB/buffer_size"]);
+                     config["/INFLUXDB/buffer_size"],
+                     InfluxDbLogger::ReadOptions(config["/INFLUXDB"]));
 #endif
          initialized = true;
     }
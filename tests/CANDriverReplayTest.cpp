@@ -0,0 +1,239 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "can/CANDriverReplay.h"
+#include "can_houbolt/can_cmds.h"
+#include "can_houbolt/channels/generic_channel_def.h"
+
+class CANDriverReplayTestConfig : public Config {
+public:
+    explicit CANDriverReplayTestConfig(nlohmann::json data) {
+        this->data = std::move(data);
+    }
+};
+
+class CANDriverReplayTest : public testing::Test {
+protected:
+    typedef struct {
+        uint8_t canBusChannelID;
+        uint32_t canID;
+        uint32_t payloadLength;
+        uint64_t timestamp;
+    } Received_t;
+
+    std::filesystem::path testDir;
+    std::filesystem::path oldWorkingDir;
+    std::string recordingDir;
+
+    std::mutex receivedMtx;
+    std::vector<Received_t> received;
+
+    void SetUp() override {
+        testDir = std::filesystem::temp_directory_path() / "llserver_can_replay_test";
+        std::filesystem::remove_all(testDir);
+        std::filesystem::create_directories(testDir);
+        // the recorder starts in logs/<date> relative to the working directory before it is rotated
+        oldWorkingDir = std::filesystem::current_path();
+        std::filesystem::current_path(testDir);
+        recordingDir = (testDir / "recording").string();
+    }
+
+    void TearDown() override {
+        std::filesystem::current_path(oldWorkingDir);
+        std::filesystem::remove_all(testDir);
+    }
+
+    static uint32_t CanID(uint8_t nodeID, uint8_t direction) {
+        Can_MessageId_t canID = {};
+        canID.info.direction = direction;
+        canID.info.node_id = nodeID;
+        return canID.uint32;
+    }
+
+    // 2 nodes answering on bus 0 and 1, a lora node info and sensor data in between
+    void Record() {
+        nlohmann::json data = {{"CAN", {{"enable_recorder", true}}}};
+        CANDriverReplayTestConfig config(data);
+        CANRecorder *recorder = CANRecorder::Instance();
+        recorder->Init(config);
+        recorder->Rotate(recordingDir);
+
+        Can_MessageData_t nodeInfo = {};
+        nodeInfo.bit.info.channel_id = GENERIC_CHANNEL_ID;
+        nodeInfo.bit.cmd_id = GENERIC_RES_NODE_INFO;
+        uint8_t data8[8] = {0};
+
+        recorder->Record(0, CanID(5, NODE2MASTER_DIRECTION), nodeInfo.uint8, 16, 1000000);
+        recorder->Record(1, CanID(6, NODE2MASTER_DIRECTION), nodeInfo.uint8, 16, 1000100);
+        recorder->Record(0, CanID(7, NODE2MASTER_DIRECTION), nodeInfo.uint8, 16, 1000200, CANRecord::FLAG_LORA);
+        for (uint32_t i = 0; i < 10; i++) {
+            recorder->Record(i % 2, CanID(5 + i % 2, NODE2MASTER_DIRECTION), data8, 8, 1000300 + i * 100);
+        }
+        recorder->Stop();
+    }
+
+    // 101 frames 10ms apart, one second of recording
+    void RecordSecond() {
+        nlohmann::json data = {{"CAN", {{"enable_recorder", true}, {"recorder_index_interval", 10000}}}};
+        CANDriverReplayTestConfig config(data);
+        CANRecorder *recorder = CANRecorder::Instance();
+        recorder->Init(config);
+        recorder->Rotate(recordingDir);
+
+        for (uint32_t i = 0; i <= 100; i++) {
+            uint8_t payload[8] = {(uint8_t) i};
+            recorder->Record(i % 2, CanID(5, NODE2MASTER_DIRECTION), payload, 8, 2000000 + i * 10000);
+        }
+        recorder->Stop();
+    }
+
+    CANDriverReplay *CreateDriver(nlohmann::json canConfig) {
+        canConfig["replay_path"] = recordingDir;
+        nlohmann::json data = {{"CAN", canConfig}};
+        CANDriverReplayTestConfig config(data);
+        return new CANDriverReplay(
+            [this](uint8_t &canBusChannelID, uint32_t &canID, uint8_t *, uint32_t &payloadLength, uint64_t &timestamp, CANDriver *) {
+                std::lock_guard<std::mutex> lock(receivedMtx);
+                received.push_back({canBusChannelID, canID, payloadLength, timestamp});
+            },
+            [](std::string *) {}, config);
+    }
+
+    static void RequestNodeInfos(CANDriver *driver) {
+        Can_MessageData_t msg = {};
+        msg.bit.info.channel_id = GENERIC_CHANNEL_ID;
+        msg.bit.cmd_id = GENERIC_REQ_NODE_INFO;
+        driver->SendCANMessage(0, CanID(0, MASTER2NODE_DIRECTION), msg.uint8, 2, false);
+    }
+
+    size_t ReceivedCount() {
+        std::lock_guard<std::mutex> lock(receivedMtx);
+        return received.size();
+    }
+
+    bool WaitForFrames(size_t count) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (ReceivedCount() < count) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    // seconds from Start until the whole recording was played
+    double PlaySecond(double speed) {
+        RecordSecond();
+        CANDriverReplay *driver = CreateDriver({{"replay_speed", speed}});
+        auto start = std::chrono::steady_clock::now();
+        driver->Start();
+        EXPECT_TRUE(WaitForFrames(101));
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        delete driver;
+        return elapsed;
+    }
+};
+
+TEST_F(CANDriverReplayTest, NodeInfoRequestIsAnsweredFromRecording) {
+    Record();
+    CANDriverReplay *driver = CreateDriver({{"replay_speed", 0}});
+
+    RequestNodeInfos(driver);
+    {
+        std::lock_guard<std::mutex> lock(receivedMtx);
+        // the lora node info belongs to another driver
+        ASSERT_EQ(received.size(), 2);
+        EXPECT_EQ(received[0].canBusChannelID, 0);
+        EXPECT_EQ(received[0].canID, CanID(5, NODE2MASTER_DIRECTION));
+        EXPECT_EQ(received[0].payloadLength, 16);
+        EXPECT_EQ(received[0].timestamp, 1000000);
+        EXPECT_EQ(received[1].canBusChannelID, 1);
+        EXPECT_EQ(received[1].canID, CanID(6, NODE2MASTER_DIRECTION));
+    }
+
+    // every request is answered again
+    RequestNodeInfos(driver);
+    EXPECT_EQ(ReceivedCount(), 4);
+    delete driver;
+}
+
+TEST_F(CANDriverReplayTest, OtherMessagesAreDiscarded) {
+    Record();
+    CANDriverReplay *driver = CreateDriver({{"replay_speed", 0}});
+
+    Can_MessageData_t msg = {};
+    msg.bit.info.channel_id = GENERIC_CHANNEL_ID;
+    msg.bit.cmd_id = GENERIC_REQ_RESET_ALL_SETTINGS;
+    driver->SendCANMessage(0, CanID(5, MASTER2NODE_DIRECTION), msg.uint8, 2, false);
+    EXPECT_EQ(ReceivedCount(), 0);
+    delete driver;
+}
+
+TEST_F(CANDriverReplayTest, RecordingIsNotPlayedBeforeStart) {
+    Record();
+    CANDriverReplay *driver = CreateDriver({{"replay_speed", 0}});
+
+    // the manager would discard the frames before its initialization, it starts the replay afterwards
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(ReceivedCount(), 0);
+    delete driver;
+}
+
+TEST_F(CANDriverReplayTest, FramesArePlayedInOrderWithOriginalTimestamps) {
+    Record();
+    CANDriverReplay *driver = CreateDriver({{"replay_speed", 0}});
+    driver->Start();
+    ASSERT_TRUE(WaitForFrames(10));
+    // give frames that shouldn't be played a chance to arrive
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    delete driver;
+
+    // node infos are only answered on request and the lora frame belongs to another driver
+    ASSERT_EQ(received.size(), 10);
+    for (uint32_t i = 0; i < received.size(); i++) {
+        EXPECT_EQ(received[i].canBusChannelID, i % 2);
+        EXPECT_EQ(received[i].canID, CanID(5 + i % 2, NODE2MASTER_DIRECTION));
+        EXPECT_EQ(received[i].payloadLength, 8);
+        EXPECT_EQ(received[i].timestamp, 1000300 + i * 100);
+    }
+}
+
+TEST_F(CANDriverReplayTest, MaxSpeedDoesNotWait) {
+    EXPECT_LT(PlaySecond(0), 0.05);
+}
+
+TEST_F(CANDriverReplayTest, FramesArePacedByReplaySpeed) {
+    // one second of recording at 10x
+    double elapsed = PlaySecond(10);
+    EXPECT_GT(elapsed, 0.095);
+    EXPECT_LT(elapsed, 0.3);
+}
+
+TEST_F(CANDriverReplayTest, ReplayStartsAtReplayStartTime) {
+    RecordSecond();
+    CANDriverReplay *driver = CreateDriver({{"replay_speed", 0}, {"replay_start_time", 2500000}});
+    driver->Start();
+    ASSERT_TRUE(WaitForFrames(51));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    delete driver;
+
+    ASSERT_EQ(received.size(), 51);
+    EXPECT_EQ(received.front().timestamp, 2500000);
+    EXPECT_EQ(received.back().timestamp, 3000000);
+}
+
+TEST_F(CANDriverReplayTest, InvalidConfigThrows) {
+    EXPECT_THROW(CreateDriver({}), std::runtime_error);
+
+    Record();
+    EXPECT_THROW(CreateDriver({{"replay_speed", -1}}), std::runtime_error);
+}
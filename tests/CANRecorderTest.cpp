@@ -0,0 +1,176 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include "can/CANRecorder.h"
+
+class CANRecorderTestConfig : public Config {
+public:
+    explicit CANRecorderTestConfig(nlohmann::json data) {
+        this->data = std::move(data);
+    }
+};
+
+class CANRecorderTest : public testing::Test {
+protected:
+    std::filesystem::path testDir;
+    std::filesystem::path oldWorkingDir;
+    std::string recordingDir;
+    CANRecorder *recorder = CANRecorder::Instance();
+
+    void SetUp() override {
+        testDir = std::filesystem::temp_directory_path() / "llserver_can_recorder_test";
+        std::filesystem::remove_all(testDir);
+        std::filesystem::create_directories(testDir);
+        // Init starts recording into logs/<date> relative to the working directory
+        oldWorkingDir = std::filesystem::current_path();
+        std::filesystem::current_path(testDir);
+        recordingDir = (testDir / "recording").string();
+    }
+
+    void TearDown() override {
+        recorder->Stop();
+        std::filesystem::current_path(oldWorkingDir);
+        std::filesystem::remove_all(testDir);
+    }
+
+    void Start(size_t segmentSize, uint64_t indexInterval) {
+        nlohmann::json data = {{"CAN", {
+            {"enable_recorder", true},
+            {"recorder_segment_size", segmentSize},
+            {"recorder_index_interval", indexInterval}
+        }}};
+        CANRecorderTestConfig config(data);
+        recorder->Init(config);
+        recorder->Rotate(recordingDir);
+    }
+
+    static std::vector<uint8_t> Payload(uint32_t i, uint32_t length) {
+        std::vector<uint8_t> payload(length);
+        for (uint32_t j = 0; j < length; j++) {
+            payload[j] = (uint8_t) (i * 31 + j);
+        }
+        return payload;
+    }
+
+    std::vector<CANRecord::Frame_t> ReadAll(uint64_t seekTimestamp = 0) {
+        CANRecordReader reader(recordingDir);
+        EXPECT_TRUE(reader.Open());
+        if (seekTimestamp != 0) {
+            reader.Seek(seekTimestamp);
+        }
+        std::vector<CANRecord::Frame_t> frames;
+        CANRecord::Frame_t frame;
+        while (reader.Next(frame)) {
+            frames.push_back(frame);
+        }
+        return frames;
+    }
+};
+
+TEST_F(CANRecorderTest, RecordedFramesAreReadBackUnchanged) {
+    Start(1024 * 1024, 10000);
+    // every payload length changes the padding of the following frame
+    uint64_t recordedBefore = recorder->GetRecordedFrames();
+    for (uint32_t i = 0; i <= CANRecord::MAX_PAYLOAD_LENGTH; i++) {
+        std::vector<uint8_t> payload = Payload(i, i);
+        uint8_t flags = i % 5 == 0 ? CANRecord::FLAG_LORA : 0;
+        recorder->Record(i % 4, 0x100 + i, payload.data(), i, 1000000 + i * 100, flags);
+    }
+    recorder->Stop();
+    EXPECT_EQ(recorder->GetRecordedFrames() - recordedBefore, CANRecord::MAX_PAYLOAD_LENGTH + 1);
+
+    std::vector<CANRecord::Frame_t> frames = ReadAll();
+    ASSERT_EQ(frames.size(), CANRecord::MAX_PAYLOAD_LENGTH + 1);
+    for (uint32_t i = 0; i < frames.size(); i++) {
+        std::vector<uint8_t> payload = Payload(i, i);
+        EXPECT_EQ(frames[i].timestamp, 1000000 + i * 100);
+        EXPECT_EQ(frames[i].canID, 0x100 + i);
+        EXPECT_EQ(frames[i].canBusChannelID, i % 4);
+        EXPECT_EQ(frames[i].flags, i % 5 == 0 ? CANRecord::FLAG_LORA : 0);
+        ASSERT_EQ(frames[i].payloadLength, i);
+        EXPECT_EQ(std::vector<uint8_t>(frames[i].payload, frames[i].payload + i), payload);
+    }
+}
+
+TEST_F(CANRecorderTest, OversizedPayloadIsDropped) {
+    Start(1024 * 1024, 10000);
+    uint64_t droppedBefore = recorder->GetDroppedFrames();
+    std::vector<uint8_t> payload = Payload(0, CANRecord::MAX_PAYLOAD_LENGTH + 1);
+    recorder->Record(0, 0x100, payload.data(), payload.size(), 1000000);
+    recorder->Record(0, 0x101, payload.data(), 8, 1000100);
+    recorder->Stop();
+    EXPECT_EQ(recorder->GetDroppedFrames() - droppedBefore, 1);
+
+    std::vector<CANRecord::Frame_t> frames = ReadAll();
+    ASSERT_EQ(frames.size(), 1);
+    EXPECT_EQ(frames[0].canID, 0x101);
+}
+
+TEST_F(CANRecorderTest, FullSegmentContinuesInNextPart) {
+    // room for 4 frames with 8 byte payload per segment
+    Start(CANRecord::SEGMENT_HEADER_SIZE + 4 * CANRecord::FrameSize(8), 10000);
+    for (uint32_t i = 0; i < 10; i++) {
+        std::vector<uint8_t> payload = Payload(i, 8);
+        recorder->Record(0, i, payload.data(), 8, 1000000 + i);
+    }
+    recorder->Stop();
+
+    EXPECT_TRUE(std::filesystem::exists(CANRecord::SegmentPath(recordingDir, 2)));
+    EXPECT_FALSE(std::filesystem::exists(CANRecord::SegmentPath(recordingDir, 3)));
+    // closed segments are truncated to the frames they hold
+    EXPECT_EQ(std::filesystem::file_size(CANRecord::SegmentPath(recordingDir, 2)),
+              CANRecord::SEGMENT_HEADER_SIZE + 2 * CANRecord::FrameSize(8));
+
+    std::vector<CANRecord::Frame_t> frames = ReadAll();
+    ASSERT_EQ(frames.size(), 10);
+    for (uint32_t i = 0; i < frames.size(); i++) {
+        EXPECT_EQ(frames[i].canID, i);
+    }
+}
+
+TEST_F(CANRecorderTest, SeekStartsAtLastIndexedFrameBefore) {
+    Start(CANRecord::SEGMENT_HEADER_SIZE + 16 * CANRecord::FrameSize(8), 1000);
+    for (uint32_t i = 0; i < 100; i++) {
+        std::vector<uint8_t> payload = Payload(i, 8);
+        recorder->Record(0, i, payload.data(), 8, 1000000 + i * 100);
+    }
+    recorder->Stop();
+
+    // frames are indexed every 1000us, the frame at 1005000 is the last one indexed before 1005500
+    std::vector<CANRecord::Frame_t> frames = ReadAll(1005500);
+    ASSERT_EQ(frames.size(), 50);
+    EXPECT_EQ(frames.front().timestamp, 1005000);
+    EXPECT_EQ(frames.back().timestamp, 1009900);
+
+    EXPECT_EQ(ReadAll(999999).size(), 100);
+}
+
+TEST_F(CANRecorderTest, UncommittedFrameEndsSegment) {
+    Start(1024 * 1024, 10000);
+    for (uint32_t i = 0; i < 5; i++) {
+        std::vector<uint8_t> payload = Payload(i, 8);
+        recorder->Record(0, i, payload.data(), 8, 1000000 + i);
+    }
+    recorder->Stop();
+
+    // simulate a frame torn by a crash
+    std::fstream segment(CANRecord::SegmentPath(recordingDir, 0), std::ios::in | std::ios::out | std::ios::binary);
+    segment.seekp(CANRecord::SEGMENT_HEADER_SIZE + 3 * CANRecord::FrameSize(8) + offsetof(CANRecord::FrameHeader_t, committed));
+    segment.put(0);
+    segment.close();
+
+    std::vector<CANRecord::Frame_t> frames = ReadAll();
+    ASSERT_EQ(frames.size(), 3);
+    EXPECT_EQ(frames.back().canID, 2);
+}
+
+TEST_F(CANRecorderTest, OpenFailsWithoutRecording) {
+    CANRecordReader reader((testDir / "missing").string());
+    EXPECT_FALSE(reader.Open());
+}
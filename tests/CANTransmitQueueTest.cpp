@@ -0,0 +1,196 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "can/CANTransmitQueue.h"
+
+class CANTransmitQueueTest : public testing::Test {
+protected:
+    typedef struct {
+        uint32_t canBusChannelID;
+        std::vector<TxFrame_t> frames;
+    } Batch_t;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<Batch_t> batches;
+    size_t sentFrames = 0;
+    // while closed, send blocks after taking its batch, so the next frames queue up
+    bool gateOpen = true;
+    bool failSend = false;
+
+    CANTransmitQueue::SendFunction Sender() {
+        return [this](uint32_t canBusChannelID, std::span<TxFrame_t> frames) {
+            std::unique_lock<std::mutex> lock(mtx);
+            batches.push_back({canBusChannelID, std::vector<TxFrame_t>(frames.begin(), frames.end())});
+            sentFrames += frames.size();
+            cv.notify_all();
+            cv.wait(lock, [this] { return gateOpen; });
+            if (failSend) {
+                throw std::runtime_error("bus off");
+            }
+        };
+    }
+
+    bool WaitForFrames(size_t count) {
+        std::unique_lock<std::mutex> lock(mtx);
+        return cv.wait_for(lock, std::chrono::seconds(2), [this, count] { return sentFrames >= count; });
+    }
+
+    void CloseGate() {
+        std::lock_guard<std::mutex> lock(mtx);
+        gateOpen = false;
+    }
+
+    void OpenGate() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            gateOpen = true;
+        }
+        cv.notify_all();
+    }
+
+    static void Push(CANTransmitQueue &queue, uint32_t canBusChannelID, uint32_t canID, TxPriority priority = TxPriority::NORMAL) {
+        CANTransmitQueue::PriorityScope scope(priority);
+        uint8_t payload[8] = {(uint8_t) canID, 1, 2, 3, 4, 5, 6, 7};
+        queue.Push(canBusChannelID, canID, payload, sizeof(payload), false);
+    }
+};
+
+TEST_F(CANTransmitQueueTest, FramesAreSentUnchangedOnTheirBus) {
+    CANTransmitQueue queue({0, 2}, Sender(), 16, 16);
+    uint8_t payload[64];
+    for (uint32_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i;
+    }
+    queue.Push(2, 0x123, payload, sizeof(payload), true);
+    ASSERT_TRUE(WaitForFrames(1));
+
+    std::lock_guard<std::mutex> lock(mtx);
+    ASSERT_EQ(batches.size(), 1);
+    EXPECT_EQ(batches[0].canBusChannelID, 2);
+    ASSERT_EQ(batches[0].frames.size(), 1);
+    TxFrame_t &frame = batches[0].frames[0];
+    EXPECT_EQ(frame.canID, 0x123);
+    EXPECT_EQ(frame.payloadLength, 64);
+    EXPECT_TRUE(frame.blocking);
+    EXPECT_EQ(std::vector<uint8_t>(frame.payload, frame.payload + 64), std::vector<uint8_t>(payload, payload + 64));
+}
+
+TEST_F(CANTransmitQueueTest, InvalidFramesThrow) {
+    CANTransmitQueue queue({0, 2}, Sender(), 16, 16);
+    uint8_t payload[65] = {0};
+    EXPECT_THROW(queue.Push(1, 0x123, payload, 8, false), std::runtime_error);
+    EXPECT_THROW(queue.Push(3, 0x123, payload, 8, false), std::runtime_error);
+    EXPECT_THROW(queue.Push(0, 0x123, payload, sizeof(payload), false), std::runtime_error);
+}
+
+TEST_F(CANTransmitQueueTest, UrgentFramesAreSentBeforeQueuedNormalFrames) {
+    CANTransmitQueue queue({0}, Sender(), 16, 16);
+    CloseGate();
+    Push(queue, 0, 0);
+    ASSERT_TRUE(WaitForFrames(1));
+
+    // the transmit thread is busy, so these queue up for the next batch
+    Push(queue, 0, 1);
+    Push(queue, 0, 2);
+    Push(queue, 0, 10, TxPriority::URGENT);
+    Push(queue, 0, 3);
+    Push(queue, 0, 11, TxPriority::URGENT);
+    // the priority only applies inside the scope
+    Push(queue, 0, 4);
+    OpenGate();
+    ASSERT_TRUE(WaitForFrames(7));
+
+    std::lock_guard<std::mutex> lock(mtx);
+    ASSERT_EQ(batches.size(), 2);
+    std::vector<uint32_t> canIDs;
+    for (TxFrame_t &frame : batches[1].frames) {
+        canIDs.push_back(frame.canID);
+    }
+    EXPECT_EQ(canIDs, std::vector<uint32_t>({10, 11, 1, 2, 3, 4}));
+}
+
+TEST_F(CANTransmitQueueTest, BatchesAreLimitedByMaxBatch) {
+    CANTransmitQueue queue({0}, Sender(), 16, 4);
+    CloseGate();
+    Push(queue, 0, 0);
+    ASSERT_TRUE(WaitForFrames(1));
+
+    for (uint32_t canID = 1; canID <= 10; canID++) {
+        Push(queue, 0, canID);
+    }
+    OpenGate();
+    ASSERT_TRUE(WaitForFrames(11));
+
+    std::lock_guard<std::mutex> lock(mtx);
+    ASSERT_EQ(batches.size(), 4);
+    EXPECT_EQ(batches[1].frames.size(), 4);
+    EXPECT_EQ(batches[2].frames.size(), 4);
+    EXPECT_EQ(batches[3].frames.size(), 2);
+    EXPECT_EQ(batches[3].frames.back().canID, 10);
+}
+
+TEST_F(CANTransmitQueueTest, FullQueueRejectsOnlyNormalFrames) {
+    CANTransmitQueue queue({0}, Sender(), 3, 16);
+    CloseGate();
+    Push(queue, 0, 0);
+    ASSERT_TRUE(WaitForFrames(1));
+
+    Push(queue, 0, 1);
+    Push(queue, 0, 2);
+    Push(queue, 0, 3);
+    EXPECT_THROW(Push(queue, 0, 4), std::runtime_error);
+    // an abort has to get out even if normal frames are backed up
+    EXPECT_NO_THROW(Push(queue, 0, 10, TxPriority::URGENT));
+    OpenGate();
+    ASSERT_TRUE(WaitForFrames(5));
+
+    std::lock_guard<std::mutex> lock(mtx);
+    ASSERT_EQ(batches.size(), 2);
+    ASSERT_EQ(batches[1].frames.size(), 4);
+    EXPECT_EQ(batches[1].frames[0].canID, 10);
+}
+
+TEST_F(CANTransmitQueueTest, FailedBatchesAreCounted) {
+    CANTransmitQueue queue({0}, Sender(), 16, 16);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        failSend = true;
+    }
+    CloseGate();
+    Push(queue, 0, 0);
+    ASSERT_TRUE(WaitForFrames(1));
+    Push(queue, 0, 1);
+    Push(queue, 0, 2);
+    OpenGate();
+    ASSERT_TRUE(WaitForFrames(3));
+
+    // the failed frames are counted once send returned
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (queue.GetFailedFrames() < 3 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(queue.GetFailedFrames(), 3);
+}
+
+TEST_F(CANTransmitQueueTest, DestructorSendsQueuedFrames) {
+    {
+        CANTransmitQueue queue({0}, Sender(), 16, 16);
+        CloseGate();
+        Push(queue, 0, 0);
+        ASSERT_TRUE(WaitForFrames(1));
+        Push(queue, 0, 1);
+        Push(queue, 0, 2);
+        OpenGate();
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    EXPECT_EQ(sentFrames, 3);
+}
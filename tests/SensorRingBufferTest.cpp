@@ -0,0 +1,148 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <thread>
+#include <vector>
+#include "can/SensorRingBuffer.h"
+
+class SensorRingBufferTest : public testing::Test {
+protected:
+    std::array<ChannelSensorData_t, 64> buffer{};
+
+    static void PushRange(SensorRingBuffer &ring, uint64_t first, uint64_t count) {
+        for (uint64_t i = first; i < first + count; i++) {
+            ring.Push(i % 32, (double) i, 1000 + i);
+        }
+    }
+
+    static void ExpectRange(std::span<ChannelSensorData_t> samples, uint64_t first) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            EXPECT_EQ(samples[i].channelID, (first + i) % 32);
+            EXPECT_EQ(samples[i].value, (double) (first + i));
+            EXPECT_EQ(samples[i].timestamp, 1000 + first + i);
+        }
+    }
+};
+
+TEST_F(SensorRingBufferTest, CapacityIsRoundedUpToPowerOfTwo) {
+    EXPECT_EQ(SensorRingBuffer(1).GetCapacity(), 1);
+    EXPECT_EQ(SensorRingBuffer(5).GetCapacity(), 8);
+    EXPECT_EQ(SensorRingBuffer(64).GetCapacity(), 64);
+    EXPECT_THROW(SensorRingBuffer(0), std::runtime_error);
+}
+
+TEST_F(SensorRingBufferTest, ReaderStartsAtHead) {
+    SensorRingBuffer ring(8);
+    PushRange(ring, 0, 3);
+
+    SensorRingReader reader(&ring);
+    EXPECT_EQ(reader.GetPending(), 0);
+    EXPECT_TRUE(reader.Read(buffer).empty());
+
+    PushRange(ring, 3, 2);
+    auto samples = reader.Read(buffer);
+    ASSERT_EQ(samples.size(), 2);
+    ExpectRange(samples, 3);
+}
+
+TEST_F(SensorRingBufferTest, WrapsAroundWithoutLosingSamples) {
+    SensorRingBuffer ring(8);
+    SensorRingReader reader(&ring);
+
+    // 5 samples per round don't divide the capacity, so reads and writes cross the end of the ring
+    uint64_t next = 0;
+    for (int round = 0; round < 20; round++) {
+        PushRange(ring, next, 5);
+        auto samples = reader.Read(buffer);
+        ASSERT_EQ(samples.size(), 5);
+        ExpectRange(samples, next);
+        next += 5;
+    }
+    EXPECT_EQ(ring.GetHead(), next);
+    EXPECT_EQ(reader.GetOverrunCount(), 0);
+}
+
+TEST_F(SensorRingBufferTest, ReadIsLimitedByBufferSize) {
+    SensorRingBuffer ring(16);
+    SensorRingReader reader(&ring);
+    PushRange(ring, 0, 10);
+
+    auto first = reader.Read(std::span<ChannelSensorData_t>(buffer).first(4));
+    ASSERT_EQ(first.size(), 4);
+    ExpectRange(first, 0);
+    EXPECT_EQ(reader.GetPending(), 6);
+
+    auto rest = reader.Read(buffer);
+    ASSERT_EQ(rest.size(), 6);
+    ExpectRange(rest, 4);
+}
+
+TEST_F(SensorRingBufferTest, OverrunSkipsOldestSamplesAndCountsThem) {
+    SensorRingBuffer ring(8);
+    SensorRingReader reader(&ring);
+    PushRange(ring, 0, 20);
+
+    EXPECT_EQ(reader.GetPending(), 20);
+    auto samples = reader.Read(buffer);
+    ASSERT_EQ(samples.size(), 8);
+    ExpectRange(samples, 12);
+    EXPECT_EQ(reader.GetOverrunCount(), 12);
+
+    // the reader is in sync again afterwards
+    PushRange(ring, 20, 3);
+    samples = reader.Read(buffer);
+    ASSERT_EQ(samples.size(), 3);
+    ExpectRange(samples, 20);
+    EXPECT_EQ(reader.GetOverrunCount(), 12);
+}
+
+TEST_F(SensorRingBufferTest, ReadersAreIndependent) {
+    SensorRingBuffer ring(8);
+    SensorRingReader fast(&ring);
+    SensorRingReader slow(&ring);
+
+    PushRange(ring, 0, 6);
+    ASSERT_EQ(fast.Read(buffer).size(), 6);
+    PushRange(ring, 6, 6);
+    ASSERT_EQ(fast.Read(buffer).size(), 6);
+    EXPECT_EQ(fast.GetOverrunCount(), 0);
+
+    auto samples = slow.Read(buffer);
+    ASSERT_EQ(samples.size(), 8);
+    ExpectRange(samples, 4);
+    EXPECT_EQ(slow.GetOverrunCount(), 4);
+}
+
+TEST_F(SensorRingBufferTest, ConcurrentReaderSeesOrderedSamples) {
+    constexpr uint64_t SAMPLES = 200000;
+    SensorRingBuffer ring(64);
+    SensorRingReader reader(&ring);
+
+    std::thread producer([&ring]() {
+        PushRange(ring, 0, SAMPLES);
+    });
+
+    // every sample is either read intact and in order or counted as overrun
+    uint64_t read = 0;
+    double last = -1;
+    bool ordered = true;
+    bool intact = true;
+    while (read + reader.GetOverrunCount() < SAMPLES) {
+        for (ChannelSensorData_t &sample : reader.Read(buffer)) {
+            uint64_t i = (uint64_t) sample.value;
+            ordered &= sample.value > last;
+            intact &= sample.channelID == i % 32 && sample.timestamp == 1000 + i;
+            last = sample.value;
+            read++;
+        }
+    }
+    producer.join();
+
+    EXPECT_TRUE(ordered);
+    EXPECT_TRUE(intact);
+    EXPECT_EQ(read + reader.GetOverrunCount(), SAMPLES);
+}
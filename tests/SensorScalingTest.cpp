@@ -0,0 +1,99 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "can/SensorScaling.h"
+
+class SensorScalingTest : public testing::Test {
+protected:
+    static constexpr size_t CHANNELS = 32;
+
+    std::mt19937 rng{42};
+    std::array<uint8_t, 3 * CHANNELS> raw{};
+    std::array<double, CHANNELS> slopes{};
+    std::array<double, CHANNELS> offsets{};
+
+    void SetUp() override {
+        for (auto &byte : raw) {
+            byte = rng();
+        }
+        std::uniform_real_distribution<double> scaling(-10.0, 10.0);
+        for (size_t i = 0; i < CHANNELS; i++) {
+            slopes[i] = scaling(rng);
+            offsets[i] = scaling(rng);
+        }
+    }
+
+    /**
+     * @return nanoseconds per 32 channel frame
+     */
+    double Benchmark(SensorScaling::ScaleFunction_t scale, size_t frames) {
+        std::array<double, CHANNELS> values{};
+        double sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t frame = 0; frame < frames; frame++) {
+            raw[0] = frame;
+            scale(raw.data(), slopes.data(), offsets.data(), values.data(), CHANNELS);
+            sink += values[0];
+        }
+        auto end = std::chrono::steady_clock::now();
+        EXPECT_FALSE(std::isnan(sink));
+        return std::chrono::duration<double, std::nano>(end - start).count() / frames;
+    }
+};
+
+TEST_F(SensorScalingTest, MatchesScalarForEveryLength) {
+    const SensorScaling::Implementation_t &scalar = SensorScaling::GetScalarImplementation();
+
+    for (const SensorScaling::Implementation_t *simd : SensorScaling::GetSupportedImplementations()) {
+        for (size_t count = 0; count <= CHANNELS; count++) {
+            std::vector<double> expected(CHANNELS, -1), actual(CHANNELS, -1);
+
+            scalar.scaleADC16(raw.data(), slopes.data(), offsets.data(), expected.data(), count);
+            simd->scaleADC16(raw.data(), slopes.data(), offsets.data(), actual.data(), count);
+            EXPECT_EQ(expected, actual) << simd->name << " adc16, " << count << " channels";
+
+            scalar.scaleADC24(raw.data(), slopes.data(), offsets.data(), expected.data(), count);
+            simd->scaleADC24(raw.data(), slopes.data(), offsets.data(), actual.data(), count);
+            EXPECT_EQ(expected, actual) << simd->name << " adc24, " << count << " channels";
+        }
+    }
+}
+
+TEST_F(SensorScalingTest, FastestImplementationIsUsed) {
+    EXPECT_EQ(&SensorScaling::GetImplementation(), SensorScaling::GetSupportedImplementations().front());
+    EXPECT_EQ(&SensorScaling::GetScalarImplementation(), SensorScaling::GetSupportedImplementations().back());
+}
+
+TEST_F(SensorScalingTest, ADC24IsSignExtended) {
+    const uint8_t negative[3] = {0xFE, 0xFF, 0xFF};
+    const uint8_t positive[3] = {0xFF, 0xFF, 0x7F};
+    double one = 1, zero = 0, value = 0;
+
+    SensorScaling::ScaleADC24(negative, &one, &zero, &value, 1);
+    EXPECT_EQ(value, -2);
+    SensorScaling::ScaleADC24(positive, &one, &zero, &value, 1);
+    EXPECT_EQ(value, 0x7FFFFF);
+}
+
+TEST_F(SensorScalingTest, BenchmarkAgainstScalar) {
+    constexpr size_t FRAMES = 200000;
+    const SensorScaling::Implementation_t &simd = SensorScaling::GetImplementation();
+    const SensorScaling::Implementation_t &scalar = SensorScaling::GetScalarImplementation();
+
+    double scalar16 = Benchmark(scalar.scaleADC16, FRAMES);
+    double simd16 = Benchmark(simd.scaleADC16, FRAMES);
+    double scalar24 = Benchmark(scalar.scaleADC24, FRAMES);
+    double simd24 = Benchmark(simd.scaleADC24, FRAMES);
+
+    std::cout << "32 channel frame, scalar vs " << simd.name << std::endl
+              << "  adc16: " << scalar16 << " ns vs " << simd16 << " ns" << std::endl
+              << "  adc24: " << scalar24 << " ns vs " << simd24 << " ns" << std::endl;
+}
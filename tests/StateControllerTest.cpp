@@ -0,0 +1,125 @@
+//
+// Created by raffael on 17.10.26.
+//
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include "StateController.h"
+
+class StateControllerTestConfig : public Config {
+public:
+    explicit StateControllerTestConfig(nlohmann::json data) {
+        this->data = std::move(data);
+    }
+};
+
+class StateControllerTest : public testing::Test {
+protected:
+    typedef struct {
+        double oldValue;
+        double newValue;
+    } Change_t;
+
+    static constexpr int SETTERS = 4;
+    static constexpr int CHANGES = 5000;
+
+    std::filesystem::path testDir;
+
+    void SetUp() override {
+        testDir = std::filesystem::temp_directory_path() / "llserver_state_controller_test";
+        std::filesystem::create_directories(testDir);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(testDir);
+    }
+
+    nlohmann::json Config(uint64_t eventQueueSize) {
+        // nothing listens on the port, the spool keeps the logger from failing
+        return {
+            {"LLSERVER", {{"state_event_queue_size", eventQueueSize}}},
+            {"INFLUXDB", {
+                {"database_ip", "127.0.0.1"},
+                {"database_port", 9},
+                {"database_name", "test"},
+                {"state_measurement", "states"},
+                {"buffer_size", 65536},
+                {"spool_directory", testDir.string()}
+            }}
+        };
+    }
+
+    static void BusyWait(int iterations) {
+        volatile int sink = 0;
+        for (int i = 0; i < iterations; i++) {
+            sink = sink + i;
+        }
+    }
+};
+
+TEST_F(StateControllerTest, ChangesOfAStateChainWhenTheQueueIsFull) {
+    StateController *controller = StateController::Instance();
+    std::vector<std::vector<Change_t>> changes;
+    state_id_t eventState = INVALID_STATE_ID;
+    state_id_t sharedState = INVALID_STATE_ID;
+    uint64_t eventStateValue = 0;
+
+    // the callback is slow, so the queue of 4 changes is full most of the time
+    StateControllerTestConfig config(Config(4));
+    controller->Init([&](state_id_t stateID, double oldValue, double newValue) {
+        changes[stateID].push_back({oldValue, newValue});
+        BusyWait(2000);
+        // changes set by the event thread itself overflow as well, the setters write the same states
+        if (newValue > 0 && (uint64_t) newValue % 7 == 0) {
+            controller->SetState(eventState, (double) ++eventStateValue, 1);
+            controller->SetState(sharedState, -(double) eventStateValue, 1);
+        }
+    }, config);
+
+    std::vector<std::string> names = {"event", "shared"};
+    for (int setter = 0; setter < SETTERS; setter++) {
+        names.push_back("setter" + std::to_string(setter));
+    }
+    std::vector<state_id_t> ids = controller->AddUninitializedStates(names);
+    eventState = ids[0];
+    sharedState = ids[1];
+    changes.resize(*std::max_element(ids.begin(), ids.end()) + 1);
+
+    std::vector<std::thread> setters;
+    for (int setter = 0; setter < SETTERS; setter++) {
+        setters.emplace_back([&, setter]() {
+            for (int i = 1; i <= CHANGES; i++) {
+                controller->SetState(ids[2 + setter], i, i);
+                controller->SetState(sharedState, setter * CHANGES + i, i);
+            }
+        });
+    }
+    for (std::thread &setter : setters) {
+        setter.join();
+    }
+    controller->StopEvents();
+
+    // every change starts at the value the previous change of the state ended with
+    for (state_id_t stateID : ids) {
+        const std::vector<Change_t> &stateChanges = changes[stateID];
+        ASSERT_FALSE(stateChanges.empty());
+        EXPECT_EQ(stateChanges.front().oldValue, 0);
+        size_t broken = 0;
+        for (size_t i = 1; i < stateChanges.size(); i++) {
+            broken += stateChanges[i].oldValue != stateChanges[i - 1].newValue;
+        }
+        EXPECT_EQ(broken, 0) << "state " << controller->GetStateName(stateID);
+        EXPECT_EQ(stateChanges.back().newValue, controller->GetStateValue(stateID));
+    }
+
+    for (int setter = 0; setter < SETTERS; setter++) {
+        EXPECT_EQ(changes[ids[2 + setter]].size(), CHANGES);
+    }
+    EXPECT_EQ(changes[eventState].size(), eventStateValue);
+    EXPECT_EQ(changes[sharedState].size(), SETTERS * CHANGES + eventStateValue);
+}